@@ -3,6 +3,7 @@
 // Licensed under the MIT license. See https://aka.ms/csspeech/license for the full license information.
 //
 
+#include <chrono>
 #include <iostream>
 #include <thread>
 #include <speechapi_cxx.h>
@@ -277,6 +278,13 @@ void PushStreamInputReader(shared_ptr<PushAudioInputStream> pushStream)
 
         vector<uint8_t> buffer(3200); // 100ms of 16kHz 16-bit mono audio
 
+        // 0 pushes the file as fast as it can be read. 1 pushes it at the
+        // rate a microphone would capture it, 2 at twice that rate, and so on.
+        const double realTimeSpeed = 0;
+        const double bytesPerSecond = realTimeSpeed * GetEmbeddedSpeechSamplesPerSecond() * GetEmbeddedSpeechBitsPerSample() / 8 * GetEmbeddedSpeechChannels();
+        uint64_t pushedBytes = 0;
+        auto start = chrono::steady_clock::now();
+
         while (true)
         {
             // Read audio data from the input stream to a data buffer.
@@ -288,6 +296,14 @@ void PushStreamInputReader(shared_ptr<PushAudioInputStream> pushStream)
             // Data must NOT include any headers, only audio samples.
             pushStream->Write(buffer.data(), (uint32_t)bytesRead);
 
+            // Wait until the next buffer would have been captured, counting
+            // from the start so the time spent reading is not added each time.
+            pushedBytes += bytesRead;
+            if (realTimeSpeed > 0)
+            {
+                this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(pushedBytes / bytesPerSecond)));
+            }
+
             if (!input)
             {
                 input.close();
@@ -134,38 +134,6 @@ void MeetingTranscriptionWithMicrophoneUsingAudioProcessingOptions()
 // Transcribing meeting using a pull audio stream with 7 + reference channel audio
 void MeetingTranscriptionWithPullAudioStreamUsingMultichannelAudio()
 {
-    // First, define your own pull audio input stream callback class that implements the
-    // PullAudioInputStreamCallback interface. The sample here illustrates how to define such
-    // a callback that reads audio data from a wav file.
-    // AudioInputFromFileCallback implements PullAudioInputStreamCallback interface, and uses a wav file as source
-    class AudioInputFromFileCallback final : public PullAudioInputStreamCallback
-    {
-    public:
-        // Constructor that creates an input stream from a file.
-        AudioInputFromFileCallback(const string& audioFileName)
-            : m_reader(audioFileName)
-        {
-        }
-        // Implements AudioInputStream::Read() which is called to get data from the audio stream.
-        // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
-        // If the data available is less than 'size' bytes, it is allowed to just return the amount of data that is currently available.
-        // If there is no data, this function must wait until data is available.
-        // It returns the number of bytes that have been copied in 'dataBuffer'.
-        // It returns 0 to indicate that the stream reaches end or is closed.
-        int Read(uint8_t* dataBuffer, uint32_t size) override
-        {
-            return m_reader.Read(dataBuffer, size);
-        }
-        // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
-        void Close() override
-        {
-            m_reader.Close();
-        }
-
-    private:
-        WavFileReader m_reader;
-    };
-
     // Creates an instance of a speech config with your subscription key and region.
     // Replace with your own subscription key and service region (e.g., "eastasia").
     // Meeting Transcription is currently available in eastasia and centralus region.
@@ -19,36 +19,6 @@ using namespace Microsoft::CognitiveServices::Speech::Speaker;
 
 const string audioDirName{ "..\\..\\..\\..\\..\\SampleData\\audiofiles\\" };
 
-// AudioInputFromFileCallback implements PullAudioInputStreamCallback interface, and uses a wav file as source
-class AudioInputFromFileCallback final : public PullAudioInputStreamCallback
-{
-public:
-    // Constructor that creates an input stream from a file.
-    AudioInputFromFileCallback(const string& audioFileName)
-        : m_reader(audioFileName)
-    {
-    }
-
-    // Implements AudioInputStream::Read() which is called to get data from the audio stream.
-    // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
-    // If the data available is less than 'size' bytes, it is allowed to just return the amount of data that is currently available.
-    // If there is no data, this function must wait until data is available.
-    // It returns the number of bytes that have been copied in 'dataBuffer'.
-    // It returns 0 to indicate that the stream reaches end or is closed.
-    int Read(uint8_t* dataBuffer, uint32_t size) override
-    {
-        return m_reader.Read(dataBuffer, size);
-    }
-    // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
-    void Close() override
-    {
-        m_reader.Close();
-    }
-
-private:
-    WavFileReader m_reader;
-};
-
 // helper functions
 shared_ptr<VoiceProfile> VoiceProfileEnrollmentWithMicrophone(const shared_ptr<VoiceProfileClient>& client);
 void VerifyVoiceProfileFromMicrophone(const shared_ptr<SpeechConfig>& config, const shared_ptr<VoiceProfile>& profile);
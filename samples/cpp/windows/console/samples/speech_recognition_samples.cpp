@@ -12,6 +12,8 @@
 #include "wav_file_reader.h"
 #include <vector>
 #include <future>
+#include <chrono>
+#include <thread>
 
 using namespace std;
 using namespace Microsoft::CognitiveServices::Speech;
@@ -266,38 +268,9 @@ void SpeechRecognitionUsingCustomizedModel()
 
 void SpeechContinuousRecognitionWithPullStream()
 {
-    // First, define your own pull audio input stream callback class that implements the
-    // PullAudioInputStreamCallback interface. The sample here illustrates how to define such
-    // a callback that reads audio data from a wav file.
-    // AudioInputFromFileCallback implements PullAudioInputStreamCallback interface, and uses a wav file as source
-    class AudioInputFromFileCallback final : public PullAudioInputStreamCallback
-    {
-    public:
-        // Constructor that creates an input stream from a file.
-        AudioInputFromFileCallback(const string& audioFileName)
-            : m_reader(audioFileName)
-        {
-        }
-
-        // Implements AudioInputStream::Read() which is called to get data from the audio stream.
-        // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
-        // If the data available is less than 'size' bytes, it is allowed to just return the amount of data that is currently available.
-        // If there is no data, this function must wait until data is available.
-        // It returns the number of bytes that have been copied in 'dataBuffer'.
-        // It returns 0 to indicate that the stream reaches end or is closed.
-        int Read(uint8_t* dataBuffer, uint32_t size) override
-        {
-            return m_reader.Read(dataBuffer, size);
-        }
-        // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
-        void Close() override
-        {
-            m_reader.Close();
-        }
-
-    private:
-        WavFileReader m_reader;
-    };
+    // To read audio from your own source, define a pull audio input stream callback class that implements the
+    // PullAudioInputStreamCallback interface. AudioInputFromFileCallback in wav_file_reader.h illustrates how
+    // to define such a callback that reads audio data from a wav file.
 
     // Creates an instance of a speech config with specified subscription key and service region.
     // Replace with your own subscription key and service region (e.g., "westus").
@@ -437,15 +410,30 @@ void SpeechContinuousRecognitionWithPushStream()
 
     vector<uint8_t> buffer(1000);
 
+    // To see latency and end of speech detection as with a microphone, push the file at a multiple of real time:
+    // 1 for real time, 2 for twice as fast. 0 pushes it as fast as it can be read.
+    const double realTimeSpeed = 0;
+    // The push stream expects 16 kHz, 16 bits per sample, mono audio: 32000 bytes per second.
+    const double bytesPerSecond = 32000 * realTimeSpeed;
+
     // Starts continuous recognition. Uses StopContinuousRecognitionAsync() to stop recognition.
     recognizer->StartContinuousRecognitionAsync().wait();
 
     // Read data and push them into the stream
     int readSamples = 0;
+    uint64_t pushedBytes = 0;
+    auto start = chrono::steady_clock::now();
     while((readSamples = reader.Read(buffer.data(), (uint32_t)buffer.size())) != 0)
     {
         // Push a buffer into the stream
         pushStream->Write(buffer.data(), readSamples);
+
+        // Then wait for the time the audio pushed so far would take to capture.
+        pushedBytes += readSamples;
+        if (realTimeSpeed > 0)
+        {
+            this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(pushedBytes / bytesPerSecond)));
+        }
     }
 
     // Close the push stream.
@@ -1241,39 +1229,6 @@ void SpeechContinuousRecognitionFromMultiChannelFileWithMASEnabledAndCustomGeome
 // Speech recognition from pull stream with custom set of enhancements from Microsoft Audio Stack enabled.
 void SpeechRecognitionFromPullStreamWithSelectMASEnhancementsEnabled()
 {
-    // First, define your own pull audio input stream callback class that implements the
-    // PullAudioInputStreamCallback interface. The sample here illustrates how to define such
-    // a callback that reads audio data from a wav file.
-    // AudioInputFromFileCallback implements PullAudioInputStreamCallback interface, and uses a wav file as source
-    class AudioInputFromFileCallback final : public PullAudioInputStreamCallback
-    {
-    public:
-        // Constructor that creates an input stream from a file.
-        AudioInputFromFileCallback(const string& audioFileName)
-            : m_reader(audioFileName)
-        {
-        }
-
-        // Implements AudioInputStream::Read() which is called to get data from the audio stream.
-        // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
-        // If the data available is less than 'size' bytes, it is allowed to just return the amount of data that is currently available.
-        // If there is no data, this function must wait until data is available.
-        // It returns the number of bytes that have been copied in 'dataBuffer'.
-        // It returns 0 to indicate that the stream reaches end or is closed.
-        int Read(uint8_t* dataBuffer, uint32_t size) override
-        {
-            return m_reader.Read(dataBuffer, size);
-        }
-        // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
-        void Close() override
-        {
-            m_reader.Close();
-        }
-
-    private:
-        WavFileReader m_reader;
-    };
-
     // Creates an instance of a speech config with specified subscription key and service region.
     // Replace with your own subscription key and service region (e.g., "westus").
     auto config = SpeechConfig::FromSubscription("YourSubscriptionKey", "YourServiceRegion");
@@ -5,9 +5,31 @@
 #pragma once
 
 #include <speechapi_cxx.h>
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#if defined(_WIN32)
+// Keeps windows.h from including winsock.h, which conflicts with winsock2.h if a sample includes it later,
+// and from defining min and max macros.
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Helper functions
+// Reads the audio data of a WAV file from a read-only memory-mapped view of the file, so Read() copies
+// straight from the page cache instead of through a stream buffer. The file is read once from start
+// to end, and the system is told so, which lets it read further ahead.
 class WavFileReader final
 {
 public:
@@ -20,129 +42,172 @@ public:
             throw std::invalid_argument("Audio filename is empty");
         }
 
-        std::ios_base::openmode mode = std::ios_base::binary | std::ios_base::in;
-        m_fs.open(audioFileName, mode);
-        if (!m_fs.good())
+        Open(audioFileName);
+        try
         {
-            throw std::invalid_argument("Failed to open the specified audio file.");
+            // Get audio format from the file header.
+            GetFormatFromWavFile();
         }
+        catch (...)
+        {
+            Unmap();
+            throw;
+        }
+    }
 
-        // Get audio format from the file header.
-        GetFormatFromWavFile();
+    ~WavFileReader()
+    {
+        Unmap();
     }
 
+    WavFileReader(const WavFileReader&) = delete;
+    WavFileReader& operator=(const WavFileReader&) = delete;
+
     int Read(uint8_t* dataBuffer, uint32_t size)
     {
-        if (m_fs.eof())
-            // returns 0 to indicate that the stream reaches end.
-            return 0;
-        m_fs.read((char*)dataBuffer, size);
-        if (!m_fs.eof() && !m_fs.good())
-            // returns 0 to close the stream on read error.
-            return 0;
-        else
-            // returns the number of bytes that have been read.
-            return (int)m_fs.gcount();
+        // returns the number of bytes that have been read, or 0 to indicate that the stream reaches end.
+        auto length = (uint32_t)(std::min)((uint64_t)size, m_end - m_position);
+        memcpy(dataBuffer, m_data + m_position, length);
+        m_position += length;
+        return (int)length;
     }
 
     void Close()
     {
-        m_fs.close();
+        // The file stays mapped until the reader is destroyed.
+        m_position = m_end;
     }
 
 private:
     // Defines common constants for WAV format.
-    static constexpr uint16_t tagBufferSize = 4;
-    static constexpr uint16_t chunkTypeBufferSize = 4;
-    static constexpr uint16_t chunkSizeBufferSize = 4;
+    static constexpr uint64_t tagBufferSize = 4;
+    static constexpr uint64_t chunkHeaderSize = 8;
 
-    // Get format data from a wav file.
-    void GetFormatFromWavFile()
+    void Open(const std::string& audioFileName)
     {
-        char tag[tagBufferSize];
-        char chunkType[chunkTypeBufferSize];
-        char chunkSizeBuffer[chunkSizeBufferSize];
-        uint32_t chunkSize = 0;
-
-        // Set to throw exceptions when reading file header.
-        m_fs.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-        try
+#if defined(_WIN32)
+        m_file = CreateFileA(audioFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+        if (INVALID_HANDLE_VALUE == m_file || !GetFileSizeEx(m_file, &size))
+        {
+            Unmap();
+            throw std::invalid_argument("Failed to open the specified audio file.");
+        }
+        m_size = (uint64_t)size.QuadPart;
+        if (m_size > 0)
         {
-            // Checks the RIFF tag
-            m_fs.read(tag, tagBufferSize);
-            if (memcmp(tag, "RIFF", tagBufferSize) != 0)
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+            m_data = NULL == m_mapping ? nullptr : (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+#else
+        int file = open(audioFileName.c_str(), O_RDONLY);
+        struct stat status;
+        if (file < 0 || 0 != fstat(file, &status))
+        {
+            if (file >= 0)
             {
-                throw std::runtime_error("Invalid file header, tag 'RIFF' is expected.");
+                close(file);
             }
-
-            // The next is the RIFF chunk size, ignore now.
-            m_fs.read(chunkSizeBuffer, chunkSizeBufferSize);
-
-            // Checks the 'WAVE' tag in the wave header.
-            m_fs.read(chunkType, chunkTypeBufferSize);
-            if (memcmp(chunkType, "WAVE", chunkTypeBufferSize) != 0)
+            throw std::invalid_argument("Failed to open the specified audio file.");
+        }
+        m_size = (uint64_t)status.st_size;
+        if (m_size > 0)
+        {
+            void* data = mmap(nullptr, (size_t)m_size, PROT_READ, MAP_PRIVATE, file, 0);
+            m_data = MAP_FAILED == data ? nullptr : (const uint8_t*)data;
+            if (nullptr != m_data)
             {
-                throw std::runtime_error("Invalid file header, tag 'WAVE' is expected.");
+                madvise((void*)m_data, (size_t)m_size, MADV_SEQUENTIAL);
             }
+        }
+        // The mapping keeps the file open.
+        close(file);
+#endif
+        if (m_size > 0 && nullptr == m_data)
+        {
+            Unmap();
+            throw std::runtime_error("Failed to map the audio file into memory.");
+        }
+    }
+
+    void Unmap()
+    {
+#if defined(_WIN32)
+        if (nullptr != m_data)
+        {
+            UnmapViewOfFile(m_data);
+        }
+        if (NULL != m_mapping)
+        {
+            CloseHandle(m_mapping);
+            m_mapping = NULL;
+        }
+        if (INVALID_HANDLE_VALUE != m_file)
+        {
+            CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (nullptr != m_data)
+        {
+            munmap((void*)m_data, (size_t)m_size);
+        }
+#endif
+        m_data = nullptr;
+    }
+
+    // Get format data from a wav file.
+    void GetFormatFromWavFile()
+    {
+        // Checks the RIFF tag
+        if (m_size < 3 * tagBufferSize || memcmp(m_data, "RIFF", tagBufferSize) != 0)
+        {
+            throw std::runtime_error("Invalid file header, tag 'RIFF' is expected.");
+        }
+
+        // The next is the RIFF chunk size, ignore now.
+        // Checks the 'WAVE' tag in the wave header.
+        if (memcmp(m_data + 2 * tagBufferSize, "WAVE", tagBufferSize) != 0)
+        {
+            throw std::runtime_error("Invalid file header, tag 'WAVE' is expected.");
+        }
+
+        uint64_t offset = 3 * tagBufferSize;
+        while (offset + chunkHeaderSize <= m_size)
+        {
+            // chunk size is little endian
+            const uint8_t* chunkSizeBuffer = m_data + offset + tagBufferSize;
+            uint64_t chunkSize = ((uint32_t)chunkSizeBuffer[3] << 24) |
+                ((uint32_t)chunkSizeBuffer[2] << 16) |
+                ((uint32_t)chunkSizeBuffer[1] << 8) |
+                (uint32_t)chunkSizeBuffer[0];
+            uint64_t chunkData = offset + chunkHeaderSize;
 
-            bool foundDataChunk = false;
-            while (!foundDataChunk && m_fs.good() && !m_fs.eof())
+            if (memcmp(m_data + offset, "fmt ", tagBufferSize) == 0)
             {
-                ReadChunkTypeAndSize(chunkType, &chunkSize);
-                if (memcmp(chunkType, "fmt ", chunkTypeBufferSize) == 0)
+                // Reads format data.
+                if (chunkData + sizeof(m_formatHeader) > m_size)
                 {
-                    // Reads format data.
-                    m_fs.read((char *)&m_formatHeader, sizeof(m_formatHeader));
-
-                    // Skips the rest of format data.
-                    if (chunkSize > sizeof(m_formatHeader))
-                    {
-                        m_fs.seekg(chunkSize - sizeof(m_formatHeader), std::ios_base::cur);
-                    }
-                }
-                else if (memcmp(chunkType, "data", chunkTypeBufferSize) == 0)
-                {
-                    foundDataChunk = true;
-                    break;
-                }
-                else
-                {
-                    m_fs.seekg(chunkSize, std::ios_base::cur);
+                    throw std::runtime_error("Unexpected end of file or error when reading audio file.");
                 }
+                memcpy(&m_formatHeader, m_data + chunkData, sizeof(m_formatHeader));
             }
-
-            if (!foundDataChunk)
+            else if (memcmp(m_data + offset, "data", tagBufferSize) == 0)
             {
-                throw std::runtime_error("Did not find data chunk.");
-            }
-            if (m_fs.eof() && chunkSize > 0)
-            {
-                throw std::runtime_error("Unexpected end of file, before any audio data can be read.");
+                if (chunkData >= m_size && chunkSize > 0)
+                {
+                    throw std::runtime_error("Unexpected end of file, before any audio data can be read.");
+                }
+                // A size of 0, or one past the end of the file, is left by recorders that did not finish
+                // the header, so the audio data is taken to run to the end of the file.
+                m_position = chunkData;
+                m_end = (0 == chunkSize || chunkSize > m_size - chunkData) ? m_size : chunkData + chunkSize;
+                return;
             }
+            // Skips the chunk, which is padded to an even size.
+            offset = chunkData + chunkSize + (chunkSize & 1);
         }
-        catch (std::ifstream::failure e)
-        {
-            throw std::runtime_error("Unexpected end of file or error when reading audio file.");
-        }
-        // Set to not throw exceptions when starting to read audio data
-        m_fs.exceptions(std::ifstream::goodbit);
-    }
-
-    void ReadChunkTypeAndSize(char* chunkType, uint32_t* chunkSize)
-    {
-        // Read the chunk type
-        m_fs.read(chunkType, chunkTypeBufferSize);
-
-        // Read the chunk size
-        uint8_t chunkSizeBuffer[chunkSizeBufferSize];
-        m_fs.read((char*)chunkSizeBuffer, chunkSizeBufferSize);
-
-        // chunk size is little endian
-        *chunkSize = ((uint32_t)chunkSizeBuffer[3] << 24) |
-            ((uint32_t)chunkSizeBuffer[2] << 16) |
-            ((uint32_t)chunkSizeBuffer[1] << 8) |
-            (uint32_t)chunkSizeBuffer[0];
+        throw std::runtime_error("Did not find data chunk.");
     }
 
     // The format structure expected in wav files.
@@ -158,5 +223,44 @@ private:
     static_assert(sizeof(m_formatHeader) == 16, "unexpected size of m_formatHeader");
 
 private:
-    std::fstream m_fs;
+    const uint8_t* m_data = nullptr;
+    uint64_t m_size = 0;
+    // The range of the file that Read() returns, and how far it has read.
+    uint64_t m_position = 0;
+    uint64_t m_end = 0;
+#if defined(_WIN32)
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = NULL;
+#endif
+};
+
+// AudioInputFromFileCallback implements PullAudioInputStreamCallback interface, and uses a wav file as source.
+// It is shared by the samples that read audio from a pull stream.
+class AudioInputFromFileCallback final : public Microsoft::CognitiveServices::Speech::Audio::PullAudioInputStreamCallback
+{
+public:
+    // Constructor that creates an input stream from a file.
+    AudioInputFromFileCallback(const std::string& audioFileName)
+        : m_reader(audioFileName)
+    {
+    }
+
+    // Implements AudioInputStream::Read() which is called to get data from the audio stream.
+    // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
+    // If the data available is less than 'size' bytes, it is allowed to just return the amount of data that is currently available.
+    // If there is no data, this function must wait until data is available.
+    // It returns the number of bytes that have been copied in 'dataBuffer'.
+    // It returns 0 to indicate that the stream reaches end or is closed.
+    int Read(uint8_t* dataBuffer, uint32_t size) override
+    {
+        return m_reader.Read(dataBuffer, size);
+    }
+    // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
+    void Close() override
+    {
+        m_reader.Close();
+    }
+
+private:
+    WavFileReader m_reader;
 };
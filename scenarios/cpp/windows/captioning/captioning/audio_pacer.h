@@ -0,0 +1,150 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <speechapi_cxx.h>
+#include <stdexcept>
+#include <string>
+
+using namespace Microsoft::CognitiveServices::Speech::Audio;
+
+// Releases audio no faster than it would arrive from a live source, at a multiple of real time, so audio
+// from a file reaches the recognizer the way audio from a microphone would. This lets the latency and
+// endpointing of recognition be tested with files.
+// Each release waits until the audio released so far, including it, would have been captured. The time
+// is measured from the first release with the monotonic clock, rather than from the last release, so the
+// time spent oversleeping and reading does not add up: a release that is late makes the next wait shorter.
+// A release that is called late, because the reader fell behind, does not wait, as the audio would already
+// be in the buffer of a microphone. How far behind the releases fell is reported.
+class AudioPacer final
+{
+private:
+
+    // Bytes of audio released per second of time.
+    const double m_bytesPerSecond;
+    const double m_speed;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_started = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_stopped;
+    bool m_stopping = false;
+
+    // Atomic, because the report can be read while audio is being released on another thread.
+    std::atomic<uint64_t> m_bytes = 0;
+    std::atomic<int64_t> m_elapsedNanoseconds = 0;
+    std::atomic<int64_t> m_maxLateNanoseconds = 0;
+
+public:
+
+    // bytesPerSecond is the rate of the audio in real time, and speed the multiple of real time to release it at.
+    AudioPacer(size_t bytesPerSecond, double speed) : m_bytesPerSecond(bytesPerSecond * speed), m_speed(speed)
+    {
+        if (0 == bytesPerSecond || speed <= 0)
+        {
+            throw std::invalid_argument("The rate and speed of paced audio must be positive.");
+        }
+    }
+
+    AudioPacer(const AudioPacer&) = delete;
+    AudioPacer& operator=(const AudioPacer&) = delete;
+
+    // Waits until bytes more audio can be released. Returns false if the pacer is stopped first.
+    // Called from one thread at a time.
+    bool Release(size_t bytes)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!m_started)
+        {
+            m_start = now;
+            m_started = true;
+        }
+        auto released = m_bytes.load(std::memory_order_relaxed) + bytes;
+        auto deadline = m_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(released / m_bytesPerSecond));
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_stopped.wait_until(lock, deadline, [this] { return m_stopping; }))
+            {
+                return false;
+            }
+        }
+        now = std::chrono::steady_clock::now();
+        auto late = std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline).count();
+        if (late > m_maxLateNanoseconds.load(std::memory_order_relaxed))
+        {
+            m_maxLateNanoseconds.store(late, std::memory_order_relaxed);
+        }
+        m_elapsedNanoseconds.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count(), std::memory_order_relaxed);
+        m_bytes.store(released, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Makes a Release() that is waiting return false, and so do later ones. Can be called from any thread.
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_stopped.notify_all();
+    }
+
+    std::string Report() const
+    {
+        auto audioSeconds = m_bytes.load(std::memory_order_relaxed) / m_bytesPerSecond * m_speed;
+        char report[160];
+        snprintf(report, sizeof(report), "Paced input: %.1f s of audio at %gx real time in %.1f s, at most %.1f ms behind.\n",
+            audioSeconds,
+            m_speed,
+            m_elapsedNanoseconds.load(std::memory_order_relaxed) / 1e9,
+            std::max<int64_t>(0, m_maxLateNanoseconds.load(std::memory_order_relaxed)) / 1e6);
+        return report;
+    }
+};
+
+// Wraps a PullAudioInputStreamCallback to release what it reads with an AudioPacer, in chunks of at most
+// chunkBytes, as a microphone would deliver them.
+class PacedReader final : public PullAudioInputStreamCallback
+{
+private:
+
+    const std::shared_ptr<PullAudioInputStreamCallback> m_source;
+    const std::shared_ptr<AudioPacer> m_pacer;
+    const size_t m_chunkBytes;
+
+public:
+
+    PacedReader(std::shared_ptr<PullAudioInputStreamCallback> source, std::shared_ptr<AudioPacer> pacer, size_t chunkBytes)
+        : m_source(source),
+        m_pacer(pacer),
+        m_chunkBytes(chunkBytes)
+    {}
+
+    // Implements AudioInputStream::Read(). Returns 0 when the source ends or the stream is closed.
+    int Read(uint8_t* dataBuffer, uint32_t size)
+    {
+        auto length = m_source->Read(dataBuffer, (uint32_t)std::min<size_t>(size, m_chunkBytes));
+        if (length <= 0 || !m_pacer->Release(length))
+        {
+            return 0;
+        }
+        return length;
+    }
+
+    void Close()
+    {
+        m_pacer->Stop();
+        m_source->Close();
+    }
+};
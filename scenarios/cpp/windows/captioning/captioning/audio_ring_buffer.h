@@ -0,0 +1,91 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// A fixed-size byte queue between exactly one producer thread and one consumer thread.
+// Neither side takes a lock or waits: the producer publishes bytes by advancing m_head after copying
+// them in, and the consumer frees space by advancing m_tail after copying them out, so each index
+// is written by one thread only. The indexes count bytes since the start and are reduced modulo
+// the capacity, which is a power of two, when they are used.
+class AudioRingBuffer final
+{
+private:
+
+    std::vector<uint8_t> m_buffer;
+    const size_t m_mask;
+    // On separate cache lines, so the producer and consumer do not slow each other down.
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+
+    static size_t RoundUpToPowerOfTwo(size_t value)
+    {
+        size_t retval = 1;
+        while (retval < value)
+        {
+            retval <<= 1;
+        }
+        return retval;
+    }
+
+public:
+
+    // The capacity is rounded up to a power of two.
+    AudioRingBuffer(size_t capacity) : m_buffer(RoundUpToPowerOfTwo(capacity)), m_mask(m_buffer.size() - 1)
+    {}
+
+    AudioRingBuffer(const AudioRingBuffer&) = delete;
+    AudioRingBuffer& operator=(const AudioRingBuffer&) = delete;
+
+    size_t Capacity() const
+    {
+        return m_buffer.size();
+    }
+
+    // The number of bytes the consumer can read. Called by the consumer.
+    size_t Size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+    }
+
+    // Adds all length bytes of data, or nothing if there is not room for all of them.
+    // Returns false if nothing was added. Called by the producer.
+    bool TryWrite(const uint8_t* data, size_t length)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        auto tail = m_tail.load(std::memory_order_acquire);
+        if (length > m_buffer.size() - (head - tail))
+        {
+            return false;
+        }
+
+        auto offset = head & m_mask;
+        auto first = std::min(length, m_buffer.size() - offset);
+        std::memcpy(m_buffer.data() + offset, data, first);
+        std::memcpy(m_buffer.data(), data + first, length - first);
+        m_head.store(head + length, std::memory_order_release);
+        return true;
+    }
+
+    // Removes up to length bytes into data. Returns the number of bytes removed. Called by the consumer.
+    size_t Read(uint8_t* data, size_t length)
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        auto head = m_head.load(std::memory_order_acquire);
+        length = std::min(length, head - tail);
+
+        auto offset = tail & m_mask;
+        auto first = std::min(length, m_buffer.size() - offset);
+        std::memcpy(data, m_buffer.data() + offset, first);
+        std::memcpy(data + first, m_buffer.data(), length - first);
+        m_tail.store(tail + length, std::memory_order_release);
+        return length;
+    }
+};
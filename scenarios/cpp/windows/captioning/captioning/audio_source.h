@@ -0,0 +1,136 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <speechapi_cxx.h>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::CognitiveServices::Speech::Audio;
+
+// How many bytes of audio to move at a time: the whole sample frames in milliseconds of audio, and at least
+// one frame. Everything that reads, buffers or pushes audio sizes its buffers with this, so --chunk tunes
+// them all together.
+inline size_t AudioChunkBytes(size_t bytesPerSecond, size_t blockAlign, int milliseconds)
+{
+    return std::max(blockAlign, bytesPerSecond * milliseconds / 1000 / blockAlign * blockAlign);
+}
+
+// What an AudioSource has read so far.
+struct AudioSourceCounters
+{
+    uint64_t bytes = 0;
+    uint64_t reads = 0;
+    // Time spent in reads: waiting for the disk for files, and for the sender for pipes and sockets.
+    std::chrono::nanoseconds stallTime = std::chrono::nanoseconds::zero();
+
+    std::string ToString() const
+    {
+        char retval[128];
+        snprintf(retval, sizeof(retval), "%llu bytes read in %llu reads, %.1f ms waiting for input",
+            (unsigned long long)bytes,
+            (unsigned long long)reads,
+            stallTime.count() / 1e6);
+        return retval;
+    }
+};
+
+// A source of audio: a file, a memory-mapped file, a pipe, a socket or memory. Each can be a pull stream
+// callback, or the input of a PcmStreamInput, which pushes what it reads.
+// Each kind of source implements ReadSource(). Read() counts the reads, the bytes and the time they take,
+// so I/O can be measured the same way for every kind of input.
+class AudioSource : public PullAudioInputStreamCallback
+{
+private:
+
+    // Atomic, because the counters can be read while the Speech SDK reads from another thread.
+    std::atomic<uint64_t> m_bytes = 0;
+    std::atomic<uint64_t> m_reads = 0;
+    std::atomic<int64_t> m_stallNanoseconds = 0;
+
+protected:
+
+    // Copies up to size bytes of audio to dataBuffer, waiting until some is available, and returns the
+    // number of bytes copied. Returns 0 when the audio ends, or the source is stopped or closed.
+    virtual int ReadSource(uint8_t* dataBuffer, uint32_t size) = 0;
+
+    virtual void CloseSource()
+    {}
+
+public:
+
+    // Implements AudioInputStream::Read() which is called to get data from the audio stream.
+    // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
+    // It returns the number of bytes that have been copied in 'dataBuffer'.
+    // It returns 0 to indicate that the stream reaches end or is closed.
+    int Read(uint8_t* dataBuffer, uint32_t size) final
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto length = ReadSource(dataBuffer, size);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        m_stallNanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+        m_reads.fetch_add(1, std::memory_order_relaxed);
+        if (length > 0)
+        {
+            m_bytes.fetch_add(length, std::memory_order_relaxed);
+        }
+        return length;
+    }
+
+    // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
+    void Close() final
+    {
+        CloseSource();
+    }
+
+    // Makes a read that is waiting for input return 0, and so do later reads. Can be called from any thread.
+    // Sources that never wait for long, such as files, ignore this.
+    virtual void Stop()
+    {}
+
+    AudioSourceCounters GetCounters() const
+    {
+        AudioSourceCounters retval;
+        retval.bytes = m_bytes.load(std::memory_order_relaxed);
+        retval.reads = m_reads.load(std::memory_order_relaxed);
+        retval.stallTime = std::chrono::nanoseconds(m_stallNanoseconds.load(std::memory_order_relaxed));
+        return retval;
+    }
+};
+
+// Audio that is already in memory, such as a file read in advance, or audio made by the program.
+class MemoryAudioSource final : public AudioSource
+{
+private:
+
+    const std::vector<uint8_t> m_data;
+    size_t m_position = 0;
+
+protected:
+
+    int ReadSource(uint8_t* dataBuffer, uint32_t size) override
+    {
+        auto length = std::min<size_t>(size, m_data.size() - m_position);
+        std::memcpy(dataBuffer, m_data.data() + m_position, length);
+        m_position += length;
+        return (int)length;
+    }
+
+    void CloseSource() override
+    {
+        m_position = m_data.size();
+    }
+
+public:
+
+    MemoryAudioSource(std::vector<uint8_t> data) : m_data(std::move(data))
+    {}
+};
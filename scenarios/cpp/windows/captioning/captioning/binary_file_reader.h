@@ -6,42 +6,28 @@
 
 #include <fstream>
 #include <speechapi_cxx.h>
+#include "audio_source.h"
 
 using namespace Microsoft::CognitiveServices::Speech::Audio;
 
 // Adapted from code in:
 // https://github.com/Azure-Samples/cognitive-services-speech-sdk/blob/master/samples/cpp/windows/console/samples/speech_recognition_samples.cpp
-class BinaryFileReader final : public PullAudioInputStreamCallback
+// Reads a file through a stream buffer. See WavFileReader for WAV files, which it reads from a memory-mapped view.
+class BinaryFileReader final : public AudioSource
 {
 private:
 
     std::fstream m_fs;
 
-public:
-
-    // Constructor that creates an input stream from a file.
-    BinaryFileReader(const std::string& audioFileName)
-    {
-        if (audioFileName.empty())
-        {
-            throw std::invalid_argument("Audio filename is empty");
-        }
+protected:
 
-        std::ios_base::openmode mode = std::ios_base::binary | std::ios_base::in;
-        m_fs.open(audioFileName, mode);
-        if (!m_fs.good())
-        {
-            throw std::invalid_argument("Failed to open the specified audio file.");
-        }
-    }
-
-    // Implements AudioInputStream::Read() which is called to get data from the audio stream.
+    // Implements AudioSource::ReadSource(), which is called to get data from the audio stream.
     // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
     // If the data available is less than 'size' bytes, it is allowed to just return the amount of data that is currently available.
     // If there is no data, this function must wait until data is available.
     // It returns the number of bytes that have been copied in 'dataBuffer'.
     // It returns 0 to indicate that the stream reaches end or is closed.
-    int Read(uint8_t* dataBuffer, uint32_t size)
+    int ReadSource(uint8_t* dataBuffer, uint32_t size) override
     {
         if (m_fs.eof())
             // returns 0 to indicate that the stream reaches end.
@@ -55,9 +41,27 @@ public:
             return (int)m_fs.gcount();
     }
 
-    // Implements AudioInputStream::Close() which is called when the stream needs to be closed.
-    void Close()
+    // Implements AudioSource::CloseSource() which is called when the stream needs to be closed.
+    void CloseSource() override
     {
         m_fs.close();
     }
+
+public:
+
+    // Constructor that creates an input stream from a file.
+    BinaryFileReader(const std::string& audioFileName)
+    {
+        if (audioFileName.empty())
+        {
+            throw std::invalid_argument("Audio filename is empty");
+        }
+
+        std::ios_base::openmode mode = std::ios_base::binary | std::ios_base::in;
+        m_fs.open(audioFileName, mode);
+        if (!m_fs.good())
+        {
+            throw std::invalid_argument("Failed to open the specified audio file.");
+        }
+    }
 };
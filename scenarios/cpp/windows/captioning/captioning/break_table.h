@@ -0,0 +1,362 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Decodes UTF-8 caption text once into grapheme clusters and records where lines may break,
+// so CaptionHelper can measure widths and find terminators with index lookups instead of
+// re-scanning the text for every line.
+// Widths are measured in grapheme clusters, so a multi-byte character or a character followed by
+// combining marks counts as one, and a line never ends in the middle of a character.
+// Break opportunities follow the sentence boundary rules in http://unicode.org/reports/tr29/#Sentence_Boundaries
+// where they matter for captions:
+// - A full stop followed directly by a letter or digit ("3.5", "e.g") is not a break (SB6, SB7).
+// - A comma between digits ("1,000") is not a break.
+// - Closing punctuation after a terminator stays on the same line as the terminator (SB9).
+class BreakTable
+{
+public:
+
+    enum BreakClass : uint8_t
+    {
+        None = 0,
+        Space = 1,
+        FirstPass = 2,
+        SecondPass = 4
+    };
+
+private:
+
+    std::vector<char32_t> m_firstPassTerminators;
+    std::vector<char32_t> m_secondPassTerminators;
+
+    // The text of the last call to Update(). Empty after Build().
+    std::string m_text;
+
+    // Byte offset of each cluster in the text, followed by the length of the text.
+    std::vector<uint32_t> m_offsets;
+    // First code point of each cluster.
+    std::vector<char32_t> m_bases;
+    // Break classes of each cluster.
+    std::vector<uint8_t> m_classes;
+    // For each cluster index i, the largest break position p <= i, or 0 if there is none.
+    // A break position is the index of the first cluster of the next line.
+    std::vector<uint32_t> m_lastFirstPassBreak;
+    std::vector<uint32_t> m_lastSecondPassBreak;
+
+    static constexpr char32_t replacementCharacter = 0xFFFD;
+    static constexpr char32_t zeroWidthJoiner = 0x200D;
+
+    static bool IsAsciiAlphanumeric(char32_t c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static bool IsAsciiDigit(char32_t c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Approximates the Grapheme_Extend property with the ranges that occur in caption text.
+    static bool IsExtend(char32_t c)
+    {
+        return (c >= 0x0300 && c <= 0x036F)     // Combining diacritical marks
+            || (c >= 0x0483 && c <= 0x0489)     // Cyrillic combining marks
+            || (c >= 0x0591 && c <= 0x05BD)     // Hebrew points
+            || (c >= 0x0610 && c <= 0x061A)     // Arabic marks
+            || (c >= 0x064B && c <= 0x065F)     // Arabic harakat
+            || (c >= 0x0900 && c <= 0x0903)     // Devanagari signs
+            || (c >= 0x093A && c <= 0x094F)     // Devanagari vowel signs
+            || (c == 0x0E31) || (c >= 0x0E34 && c <= 0x0E3A) || (c >= 0x0E47 && c <= 0x0E4E) // Thai
+            || (c >= 0x1AB0 && c <= 0x1AFF)
+            || (c >= 0x1DC0 && c <= 0x1DFF)
+            || (c == zeroWidthJoiner)
+            || (c >= 0x20D0 && c <= 0x20FF)
+            || (c == 0x3099 || c == 0x309A)     // Combining kana voiced sound marks
+            || (c >= 0xFE00 && c <= 0xFE0F)     // Variation selectors
+            || (c >= 0xFE20 && c <= 0xFE2F)
+            || (c >= 0x1F3FB && c <= 0x1F3FF)   // Emoji skin tone modifiers
+            || (c >= 0xE0100 && c <= 0xE01EF);
+    }
+
+    // Closing punctuation (the Close class in UAX #29).
+    static bool IsClose(char32_t c)
+    {
+        return c == '"' || c == '\'' || c == ')' || c == ']' || c == '}'
+            || c == 0x2019 || c == 0x201D     // Right single and double quotation marks
+            || c == 0x300D || c == 0x300F     // Right corner brackets
+            || c == 0x3011 || c == 0xFF09;    // Right black lenticular bracket, fullwidth right parenthesis
+    }
+
+    static bool IsSpace(char32_t c)
+    {
+        return c == ' ' || c == 0x3000;
+    }
+
+    static bool Contains(const std::vector<char32_t>& xs, char32_t c)
+    {
+        for (auto x : xs)
+        {
+            if (x == c)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool IsBreakable(size_t cluster) const
+    {
+        auto base = m_bases[cluster];
+        auto previous = cluster > 0 ? m_bases[cluster - 1] : 0;
+        auto next = cluster + 1 < m_bases.size() ? m_bases[cluster + 1] : 0;
+        if ('.' == base && IsAsciiAlphanumeric(next))
+        {
+            return false;
+        }
+        if (',' == base && IsAsciiDigit(previous) && IsAsciiDigit(next))
+        {
+            return false;
+        }
+        return true;
+    }
+
+public:
+
+    void SetTerminators(const std::vector<std::string>& firstPassTerminators, const std::vector<std::string>& secondPassTerminators)
+    {
+        m_firstPassTerminators.clear();
+        m_secondPassTerminators.clear();
+        for (const auto& terminator : firstPassTerminators)
+        {
+            size_t index = 0;
+            m_firstPassTerminators.push_back(Decode(terminator, index));
+        }
+        for (const auto& terminator : secondPassTerminators)
+        {
+            size_t index = 0;
+            m_secondPassTerminators.push_back(Decode(terminator, index));
+        }
+    }
+
+    // Decodes the code point that starts at index and advances index past it.
+    // Invalid or truncated sequences decode to U+FFFD and consume one byte.
+    static char32_t Decode(std::string_view text, size_t& index)
+    {
+        auto lead = (unsigned char)text[index];
+        if (lead < 0x80)
+        {
+            index++;
+            return lead;
+        }
+
+        size_t length = 0;
+        char32_t c = 0;
+        if ((lead & 0xE0) == 0xC0)
+        {
+            length = 2;
+            c = lead & 0x1F;
+        }
+        else if ((lead & 0xF0) == 0xE0)
+        {
+            length = 3;
+            c = lead & 0x0F;
+        }
+        else if ((lead & 0xF8) == 0xF0)
+        {
+            length = 4;
+            c = lead & 0x07;
+        }
+        else
+        {
+            index++;
+            return replacementCharacter;
+        }
+
+        if (index + length > text.length())
+        {
+            index++;
+            return replacementCharacter;
+        }
+        for (size_t i = 1; i < length; i++)
+        {
+            auto continuation = (unsigned char)text[index + i];
+            if ((continuation & 0xC0) != 0x80)
+            {
+                index++;
+                return replacementCharacter;
+            }
+            c = (c << 6) | (continuation & 0x3F);
+        }
+
+        index += length;
+        return c;
+    }
+
+private:
+
+    // Decodes text from cluster kept on, and computes the break opportunities from position stable on.
+    // The clusters before kept, and the break data at and before stable, must be the same for text as they are now.
+    void BuildFrom(std::string_view text, size_t kept, size_t stable)
+    {
+        size_t index = m_offsets.empty() ? 0 : m_offsets[kept];
+        m_offsets.resize(kept);
+        m_bases.resize(kept);
+        m_classes.resize(kept);
+
+        while (index < text.length())
+        {
+            m_offsets.push_back((uint32_t)index);
+            auto base = Decode(text, index);
+
+            // Combining marks, and the code point after a zero width joiner, belong to the same cluster.
+            while (index < text.length())
+            {
+                size_t next = index;
+                auto c = Decode(text, next);
+                if (!IsExtend(c))
+                {
+                    break;
+                }
+                index = next;
+                if (zeroWidthJoiner == c && index < text.length())
+                {
+                    Decode(text, index);
+                }
+            }
+
+            uint8_t breakClass = None;
+            if (IsSpace(base))
+            {
+                breakClass |= Space;
+            }
+            if (Contains(m_firstPassTerminators, base))
+            {
+                breakClass |= FirstPass;
+            }
+            if (Contains(m_secondPassTerminators, base))
+            {
+                breakClass |= SecondPass;
+            }
+            m_bases.push_back(base);
+            m_classes.push_back(breakClass);
+        }
+        m_offsets.push_back((uint32_t)text.length());
+
+        auto size = m_bases.size();
+        m_lastFirstPassBreak.resize(size + 1);
+        m_lastSecondPassBreak.resize(size + 1);
+        std::fill(m_lastFirstPassBreak.begin() + stable + 1, m_lastFirstPassBreak.end(), 0);
+        std::fill(m_lastSecondPassBreak.begin() + stable + 1, m_lastSecondPassBreak.end(), 0);
+
+        // Mark each break position, then carry the last one forward so lookups are O(1).
+        // A cluster's break position is after it, so clusters before stable only mark positions at or before stable.
+        for (size_t cluster = stable; cluster < size; cluster++)
+        {
+            auto breakClass = m_classes[cluster];
+            if (0 == (breakClass & (FirstPass | SecondPass)) || !IsBreakable(cluster))
+            {
+                continue;
+            }
+            auto position = cluster + 1;
+            while (!IsSpace(m_bases[cluster]) && position < size && IsClose(m_bases[position]))
+            {
+                position++;
+            }
+            if (breakClass & FirstPass)
+            {
+                m_lastFirstPassBreak[position] = (uint32_t)position;
+            }
+            if (breakClass & SecondPass)
+            {
+                m_lastSecondPassBreak[position] = (uint32_t)position;
+            }
+        }
+        for (size_t position = stable + 1; position <= size; position++)
+        {
+            m_lastFirstPassBreak[position] = std::max(m_lastFirstPassBreak[position], m_lastFirstPassBreak[position - 1]);
+            m_lastSecondPassBreak[position] = std::max(m_lastSecondPassBreak[position], m_lastSecondPassBreak[position - 1]);
+        }
+    }
+
+public:
+
+    // Decodes text and computes the break opportunities. Storage is reused between calls.
+    void Build(std::string_view text)
+    {
+        m_text.clear();
+        BuildFrom(text, 0, 0);
+    }
+
+    // Like Build(), but reuses the clusters and break opportunities for the start of text that is the same
+    // as the text of the last call to Update(). When text extends that text, as successive Recognizing
+    // hypotheses usually do, decoding and break detection cost time in proportion to the change.
+    // Returns a break position at or before which the break data, and before which the clusters,
+    // are the same as before the call.
+    size_t Update(std::string_view text)
+    {
+        size_t common = std::mismatch(m_text.begin(), m_text.end(), text.begin(), text.end()).first - m_text.begin();
+
+        // Whether a cluster extends depends on the code point after it, which can be up to 4 bytes long,
+        // so keep only the clusters followed by a whole code point inside the common prefix.
+        size_t kept = 0;
+        if (common >= 4 && !m_bases.empty())
+        {
+            auto ends = m_offsets.begin() + 1;
+            kept = std::upper_bound(ends, ends + m_bases.size(), (uint32_t)(common - 4)) - ends;
+        }
+
+        // Whether a cluster is a break, and where the break is, depends on the next cluster and on
+        // any closing punctuation after it. So back up past closing punctuation, and one cluster more.
+        size_t stable = kept;
+        while (stable > 0 && IsClose(m_bases[stable - 1]))
+        {
+            stable--;
+        }
+        if (stable > 0)
+        {
+            stable--;
+        }
+
+        m_text.erase(common);
+        m_text.append(text.substr(common));
+        BuildFrom(text, kept, stable);
+        return stable;
+    }
+
+    // Number of grapheme clusters in the text.
+    size_t Size() const
+    {
+        return m_bases.size();
+    }
+
+    // Byte offset of a cluster. Offset(Size()) is the length of the text.
+    size_t Offset(size_t cluster) const
+    {
+        return m_offsets[cluster];
+    }
+
+    bool IsSpaceAt(size_t cluster) const
+    {
+        return 0 != (m_classes[cluster] & Space);
+    }
+
+    // Returns the last first-pass break position at or before position, or 0 if there is none.
+    size_t LastFirstPassBreak(size_t position) const
+    {
+        return m_lastFirstPassBreak[position];
+    }
+
+    // Returns the last second-pass break position at or before position, or 0 if there is none.
+    size_t LastSecondPassBreak(size_t position) const
+    {
+        return m_lastSecondPassBreak[position];
+    }
+};
@@ -3,72 +3,76 @@
 // Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
 //
 
-#include <iomanip>
-#include <sstream>
+#include <array>
+#include <charconv>
 #include "caption_helper.h"
 
-int CompareTimestamps(Timestamp t1, Timestamp t2)
+// "00" through "99", so each two-digit field is a single table lookup.
+static constexpr std::array<char, 200> digitPairs = []()
 {
-    auto msT1 = MillisecondsFromTimestamp(t1);
-    auto msT2 = MillisecondsFromTimestamp(t2);
-    if (msT1 > msT2)
+    std::array<char, 200> retval {};
+    for (int i = 0; i < 100; i++)
     {
-        return 1;
+        retval[i * 2] = (char)('0' + i / 10);
+        retval[i * 2 + 1] = (char)('0' + i % 10);
     }
-    else if (msT1 < msT2)
-    {
-        return -1;
-    }
-    else
-    {
-        return 0;
-    }
-}
+    return retval;
+}();
 
-uint64_t MillisecondsFromTimestamp(Timestamp ts)
+static char* WriteTwoDigits(char* out, int value)
 {
-    return ts.Hours * 3600000 + ts.Minutes * 60000 + ts.Seconds * 1000 + ts.Milliseconds;
+    out[0] = digitPairs[value * 2];
+    out[1] = digitPairs[value * 2 + 1];
+    return out + 2;
 }
 
-
-std::string StringFromTimestamp(Timestamp ts, bool srt)
+// Writes ts to buffer as HH:MM:SS.mmm, or HH:MM:SS,mmm for SRT, without allocating.
+// Hours take more than two digits if needed. Returns the number of characters written.
+// The buffer is not null-terminated.
+size_t FormatTimestamp(Timestamp ts, bool srt, char (&buffer)[timestampBufferSize])
 {
-    std::ostringstream retval;
-    retval << std::setfill('0') << std::setw(2) << ts.Hours << ":"
-        << std::setfill('0') << std::setw(2) << ts.Minutes << ":"
-        << std::setfill('0') << std::setw(2) << ts.Seconds;
-    if (srt)
+    char* out = buffer;
+    if (ts.Hours < 100)
     {
-        // SRT format requires ',' as decimal separator rather than '.'.
-        retval << ",";
+        out = WriteTwoDigits(out, ts.Hours);
     }
     else
     {
-        retval << ".";
+        out = std::to_chars(out, buffer + timestampBufferSize, ts.Hours).ptr;
     }
-    retval << std::setfill('0') << std::setw(3) << ts.Milliseconds;
-    return retval.str ();        
+    *out++ = ':';
+    out = WriteTwoDigits(out, ts.Minutes);
+    *out++ = ':';
+    out = WriteTwoDigits(out, ts.Seconds);
+    // SRT format requires ',' as decimal separator rather than '.'.
+    *out++ = srt ? ',' : '.';
+    *out++ = (char)('0' + ts.Milliseconds / 100);
+    out = WriteTwoDigits(out, ts.Milliseconds % 100);
+    return out - buffer;
 }
 
-Timestamp TimestampFromMilliseconds(uint64_t milliseconds)
+Timestamp TimestampFromTicks(Ticks ticks)
 {
-    const int seconds = milliseconds / 1000;
-    const int minutes = seconds / 60;
-    const int hours = minutes / 60;
-    return Timestamp(hours, minutes % 60, seconds % 60, milliseconds % 1000);
+    const uint64_t milliseconds = ticks.Milliseconds();
+    const uint64_t seconds = milliseconds / 1000;
+    const uint64_t minutes = seconds / 60;
+    const uint64_t hours = minutes / 60;
+    return Timestamp((int)hours, (int)(minutes % 60), (int)(seconds % 60), (int)(milliseconds % 1000));
 }
 
-Timestamp TimestampFromTicks(uint64_t ticks)
+std::vector<Caption> MergeCaptions(std::vector<std::vector<Caption>> segmentCaptions, const std::vector<Ticks>& segmentOffsets)
 {
-    const float ticksPerMillisecond = 10000.0;
-    const int milliseconds = ticks / ticksPerMillisecond;
-    const int seconds = milliseconds / 1000;
-    const int minutes = seconds / 60;
-    const int hours = minutes / 60;
-    return Timestamp(hours, minutes % 60, seconds % 60, milliseconds % 1000);
+    std::vector<Caption> retval;
+    int sequence = 1;
+    for (size_t segment = 0; segment < segmentCaptions.size(); segment++)
+    {
+        for (Caption& caption : segmentCaptions[segment])
+        {
+            caption.sequence = sequence++;
+            caption.begin = caption.begin + segmentOffsets[segment];
+            caption.end = caption.end + segmentOffsets[segment];
+            retval.push_back(std::move(caption));
+        }
+    }
+    return retval;
 }
-
-Timestamp TimestampPlusMilliseconds(Timestamp ts, uint32_t milliseconds)
-{
-    return TimestampFromMilliseconds(MillisecondsFromTimestamp(ts) + milliseconds);
-}
\ No newline at end of file
@@ -4,14 +4,18 @@
 //
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <speechapi_cxx.h>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "break_table.h"
 #include "string_helper.h"
 #include "user_config.h"
+#include "word_timings.h"
 
 using namespace Microsoft::CognitiveServices::Speech;
 
@@ -35,31 +39,115 @@ struct Timestamp
     {}
 };
 
-int CompareTimestamps(Timestamp t1, Timestamp t2);
-uint64_t MillisecondsFromTimestamp(Timestamp ts);
-std::string StringFromTimestamp(Timestamp ts, bool srt);
-Timestamp TimestampFromMilliseconds(uint64_t milliseconds);
-Timestamp TimestampFromTicks(uint64_t ticks);
-Timestamp TimestampPlusMilliseconds(Timestamp ts, uint32_t milliseconds);
+// A time in 100-nanosecond ticks, the unit of RecognitionResult::Offset() and Duration().
+// Arithmetic and comparisons are single integer operations, so caption timing stays exact
+// on streams of any length. Convert to Timestamp only to format output.
+class Ticks
+{
+private:
+
+    uint64_t m_value = 0;
+
+public:
+
+    static constexpr uint64_t perMillisecond = 10000;
+
+    constexpr Ticks() = default;
+
+    constexpr explicit Ticks(uint64_t value) : m_value(value)
+    {}
+
+    static constexpr Ticks FromMilliseconds(uint64_t milliseconds)
+    {
+        return Ticks(milliseconds * perMillisecond);
+    }
+
+    constexpr uint64_t Value() const
+    {
+        return m_value;
+    }
+
+    constexpr uint64_t Milliseconds() const
+    {
+        return m_value / perMillisecond;
+    }
+
+    constexpr Ticks operator+(Ticks other) const
+    {
+        return Ticks(m_value + other.m_value);
+    }
+
+    constexpr Ticks operator-(Ticks other) const
+    {
+        return Ticks(m_value - other.m_value);
+    }
+
+    constexpr bool operator==(Ticks other) const { return m_value == other.m_value; }
+    constexpr bool operator!=(Ticks other) const { return m_value != other.m_value; }
+    constexpr bool operator<(Ticks other) const { return m_value < other.m_value; }
+    constexpr bool operator<=(Ticks other) const { return m_value <= other.m_value; }
+    constexpr bool operator>(Ticks other) const { return m_value > other.m_value; }
+    constexpr bool operator>=(Ticks other) const { return m_value >= other.m_value; }
+};
+
+// Large enough for any Timestamp produced by TimestampFromTicks, including the separator.
+constexpr size_t timestampBufferSize = 24;
+
+size_t FormatTimestamp(Timestamp ts, bool srt, char (&buffer)[timestampBufferSize]);
+Timestamp TimestampFromTicks(Ticks ticks);
 
 struct Caption
 {
     std::optional<std::string> language;
     int sequence;
-    Timestamp begin;
-    Timestamp end;
+    Ticks begin;
+    Ticks end;
     std::string text;
     
-    Caption(std::optional<std::string> language, int sequence, Timestamp begin, Timestamp end, std::string text) : language(language), sequence(sequence), begin(begin), end(end), text(text)
+    Caption(std::optional<std::string> language, int sequence, Ticks begin, Ticks end, std::string text) : language(language), sequence(sequence), begin(begin), end(end), text(text)
     {}
 };
 
+// Combines captions from audio segments that were recognized separately. The captions for each
+// segment are moved by that segment's offset, and sequence numbers are renumbered from 1.
+std::vector<Caption> MergeCaptions(std::vector<std::vector<Caption>> segmentCaptions, const std::vector<Ticks>& segmentOffsets);
+
+// The parts of a recognition result that captioning uses. Captions are produced from these,
+// so the caption path can run on results from the Speech service or on recorded events.
+struct RecognitionEvent
+{
+    std::string text;
+    Ticks offset;
+    Ticks duration;
+    // True for Recognized results, false for Recognizing results.
+    bool isFinal;
+    // The detailed JSON result. Only used for word timings, so it can be empty.
+    std::string json;
+
+    RecognitionEvent(std::string text, Ticks offset, Ticks duration, bool isFinal, std::string json = "") : text(std::move(text)), offset(offset), duration(duration), isFinal(isFinal), json(std::move(json))
+    {}
+
+    // If includeJson is true, the event keeps the detailed JSON result, which is needed for word timings.
+    static RecognitionEvent FromResult(std::shared_ptr<RecognitionResult> result, bool includeJson = false)
+    {
+        auto isFinal = result->Reason == ResultReason::RecognizedSpeech ||
+                       result->Reason == ResultReason::RecognizedIntent ||
+                       result->Reason == ResultReason::TranslatedSpeech;
+        return RecognitionEvent(
+            result->Text,
+            Ticks(result->Offset()),
+            Ticks(result->Duration()),
+            isFinal,
+            includeJson ? result->Properties.GetProperty(PropertyId::SpeechServiceResponse_JsonResult) : "");
+    }
+};
+
 struct CaptionTiming
 {
-    Timestamp begin;
-    Timestamp end;
+    Ticks begin;
+    Ticks end;
     
-    CaptionTiming(Timestamp begin, Timestamp end) : begin(begin), end(end)
+    CaptionTiming(Ticks begin, Ticks end) : begin(begin), end(end)
     {}
 };
 
@@ -70,25 +158,39 @@ private:
     std::optional<std::string> _language;
     std::vector<std::string> _firstPassTerminators;
     std::vector<std::string> _secondPassTerminators;
-
-    int _maxWidth;
-    int _maxHeight;
-    std::vector<std::shared_ptr<RecognitionResult>> _results;
-
-    std::optional<std::vector<Caption>> _captions;
+    BreakTable _breakTable;
+
+    size_t _maxWidth;
+    size_t _maxHeight;
+    bool _useWordTimings;
+    WordTimings _wordTimings;
+
+    // Captions for results that have been pushed but not yet drained.
+    std::vector<Caption> _captions;
+    int _captionSequence = 0;
+    std::vector<std::string_view> _captionLines;
+    // Lines of the text of the last call to LinesFromHypothesis, as grapheme cluster indexes
+    // where each line starts, after leading spaces, and ends.
+    std::vector<size_t> _hypothesisLineStarts;
+    std::vector<size_t> _hypothesisLineEnds;
 
 public:
 
-    CaptionHelper(std::optional<std::string> language, int maxWidth, int maxHeight, std::vector<std::shared_ptr<RecognitionResult>> results) : _language(language), _maxWidth(maxWidth), _maxHeight(maxHeight), _results(results)
+    // If useWordTimings is true, results must be recognized with OutputFormat::Detailed and word level timestamps.
+    // Captions from results that are split into several captions are then aligned to word boundaries.
+    CaptionHelper(std::optional<std::string> language, int maxWidth, int maxHeight, bool useWordTimings = false) : _language(language), _maxWidth(maxWidth), _maxHeight(maxHeight), _useWordTimings(useWordTimings)
     {
-        // consider adapting to use http://unicode.org/reports/tr29/#Sentence_Boundaries
+        // BreakTable applies the parts of http://unicode.org/reports/tr29/#Sentence_Boundaries
+        // that matter for captions on top of these terminators.
         std::string iso639;
         if (_language.has_value())
         {
             iso639 = StringHelper::Split(_language.value(), '-')[0];
         }
+        auto isChineseOrJapanese = StringHelper::CaseInsensitiveCompare(iso639, "zh") || StringHelper::CaseInsensitiveCompare(iso639, "ja");
+        auto isCJK = isChineseOrJapanese || StringHelper::CaseInsensitiveCompare(iso639, "ko");
 
-        if (StringHelper::CaseInsensitiveCompare(iso639, "zh"))
+        if (isChineseOrJapanese)
         {
             _firstPassTerminators = {"，", "、", "；", "？", "！", "?", "!", ",", ";"};
             _secondPassTerminators = {"。", " "};
@@ -99,7 +201,9 @@ public:
             _secondPassTerminators = {" ", "."};
         }
 
-        if (maxWidth == UserConfig::defaultMaxLineLengthSBCS && (StringHelper::CaseInsensitiveCompare(iso639, "zh")))
+        _breakTable.SetTerminators(_firstPassTerminators, _secondPassTerminators);
+
+        if (maxWidth == UserConfig::defaultMaxLineLengthSBCS && isCJK)
         {
             _maxWidth = UserConfig::defaultMaxLineLengthMBCS;
         }
@@ -107,159 +211,229 @@ public:
 
     static std::vector<Caption> GetCaptions(std::optional<std::string> language, int maxWidth, int maxHeight, std::vector<std::shared_ptr<RecognitionResult>> results)
     {
-        auto helper = std::make_shared<CaptionHelper>(language, maxWidth, maxHeight, results);
-        return helper->GetCaptions();
+        auto helper = std::make_shared<CaptionHelper>(language, maxWidth, maxHeight);
+        for (const auto& result : results)
+        {
+            helper->Push(result);
+        }
+        return helper->Drain();
+    }
+
+    static std::vector<Caption> GetCaptions(std::optional<std::string> language, int maxWidth, int maxHeight, const std::vector<RecognitionEvent>& events)
+    {
+        auto helper = std::make_shared<CaptionHelper>(language, maxWidth, maxHeight);
+        for (const auto& event : events)
+        {
+            helper->Push(event);
+        }
+        return helper->Drain();
     }
 
-    std::vector<std::string> LinesFromText(std::string text)
+    std::vector<std::string> LinesFromText(std::string_view text)
     {
         std::vector<std::string> retval;
         
-        auto index = 0;
-        while (index < text.length())
+        _breakTable.Build(text);
+        size_t index = 0;
+        while (index < _breakTable.Size())
         {
-            index = SkipSkippable(text, index);
-
-            int lineLength = GetBestWidth(text, index);
-            retval.push_back(StringHelper::Trim(text.substr(index, lineLength)));
-            index = index + lineLength;
+            retval.emplace_back(NextLine(text, index));
         }
         
         return retval;
     }
-    
-    std::vector<Caption> GetCaptions()
+
+    // Adds the last _maxHeight lines of text to lines, as views that refer to text.
+    // The line breaks for the start of text that is the same as the text of the last call are reused,
+    // so when successive hypotheses extend each other, the cost is in proportion to the change
+    // rather than to the length of the text. Once the buffers have grown, this does not allocate.
+    void LinesFromHypothesis(std::string_view text, std::vector<std::string_view>& lines)
     {
-        EnsureCaptions();
-        return _captions.value();
+        auto stable = _breakTable.Update(text);
+
+        // Where a line ends depends only on the break data up to _maxWidth clusters after it starts,
+        // so a line that starts at least _maxWidth clusters before the stable position is settled.
+        size_t settled = 0;
+        if (stable >= _maxWidth)
+        {
+            settled = std::upper_bound(_hypothesisLineStarts.begin(), _hypothesisLineStarts.end(), stable - _maxWidth) - _hypothesisLineStarts.begin();
+        }
+        _hypothesisLineStarts.resize(settled);
+        _hypothesisLineEnds.resize(settled);
+
+        size_t index = settled > 0 ? _hypothesisLineEnds.back() : 0;
+        while (index < _breakTable.Size())
+        {
+            auto start = SkipSkippable(index);
+            index = start + GetBestWidth(start);
+            _hypothesisLineStarts.push_back(start);
+            _hypothesisLineEnds.push_back(index);
+        }
+
+        auto count = _hypothesisLineStarts.size();
+        for (size_t line = count > _maxHeight ? count - _maxHeight : 0; line < count; line++)
+        {
+            auto begin = _breakTable.Offset(_hypothesisLineStarts[line]);
+            auto end = _breakTable.Offset(_hypothesisLineEnds[line]);
+            lines.push_back(StringHelper::TrimView(text.substr(begin, end - begin)));
+        }
     }
 
-    void EnsureCaptions()
+    // Returns the next line of text that starts at or after the grapheme cluster at index,
+    // with whitespace trimmed, and advances index past the end of that line.
+    // The returned view refers to text, so no allocation takes place.
+    // Precondition: _breakTable was built from text.
+    std::string_view NextLine(std::string_view text, size_t& index)
+    {
+        index = SkipSkippable(index);
+
+        size_t lineLength = GetBestWidth(index);
+        auto begin = _breakTable.Offset(index);
+        auto end = _breakTable.Offset(index + lineLength);
+        index = index + lineLength;
+        return StringHelper::TrimView(text.substr(begin, end - begin));
+    }
+    
+    // Adds the captions for a result. Only final results produce captions; others are ignored.
+    // The result is not kept, so memory use does not grow with the number of results pushed.
+    void Push(std::shared_ptr<RecognitionResult> result)
     {
-        if (!_captions.has_value())
+        // RecognitionResult.Offset is uint64_t so cannot be less than 0.
+        if (0 == result->Offset() || !CaptionHelper::IsFinalResult(result))
         {
-            _captions = std::vector<Caption>();
-            AddCaptionsForAllResults();
+            return;
         }
+
+        std::optional<std::string> text = GetTextOrTranslation(result, _language);
+        if (!text.has_value())
+        {
+            return;
+        }
+
+        auto event = RecognitionEvent::FromResult(result, _useWordTimings);
+        event.text = std::move(text.value());
+        AddCaptionsForFinalResult(event);
     }
 
-    void AddCaptionsForAllResults()
+    void Push(const RecognitionEvent& event)
     {
-        for (std::shared_ptr<RecognitionResult> result : _results)
+        if (0 == event.offset.Value() || !event.isFinal)
         {
-            // RecognitionResult.Offset is uint64_t so cannot be less than 0.
-            if (0 == result->Offset() || !CaptionHelper::IsFinalResult(result))
-            {
-                continue;
-            }
+            return;
+        }
 
-            std::optional<std::string> text = GetTextOrTranslation(result);
-            if (!text.has_value())
-            {
-                continue;
-            }
+        AddCaptionsForFinalResult(event);
+    }
 
-            AddCaptionsForFinalResult(result, text.value());
-        }
+    // Returns the captions added since the last call to Drain, in sequence order.
+    std::vector<Caption> Drain()
+    {
+        std::vector<Caption> retval;
+        retval.swap(_captions);
+        return retval;
     }
     
-    std::optional<std::string> GetTextOrTranslation(std::shared_ptr<RecognitionResult> result)
+    // Returns the translation of result into language, or std::nullopt if result is not a
+    // TranslationRecognitionResult or has no translation into language.
+    static std::optional<std::string> GetTranslation(std::shared_ptr<RecognitionResult> result, const std::optional<std::string>& language)
     {
+        auto translationResult = std::dynamic_pointer_cast<Translation::TranslationRecognitionResult>(result);
+        if (!translationResult || !language.has_value())
+        {
+            return std::nullopt;
+        }
+        const auto& translations = translationResult->Translations;
+        auto translation = translations.find(language.value());
+        if (translations.end() == translation)
+        {
+            return std::nullopt;
+        }
+        return translation->second;
+    }
+
+    // Returns the translation of result into language if there is one, and otherwise the recognized text,
+    // so a CaptionHelper for a target language captions the translation, and one for the recognized
+    // language captions the recognized text.
+    static std::optional<std::string> GetTextOrTranslation(std::shared_ptr<RecognitionResult> result, const std::optional<std::string>& language)
+    {
+        auto translation = GetTranslation(result, language);
+        if (translation.has_value())
+        {
+            return translation;
+        }
         return result->Text;
-        // TODO2 Handle TranslationRecognitionResults.
     }
     
-    void AddCaptionsForFinalResult(std::shared_ptr<RecognitionResult> result, std::string text)
+    void AddCaptionsForFinalResult(const RecognitionEvent& event)
     {
-        auto captionStartsAt = 0;
-        std::vector<std::string> captionLines;
-
-        auto index = 0;
-        while (index < text.length())
+        std::string_view text = event.text;
+        size_t captionStartsAt = 0;
+        // Reuse the line buffer between captions and results so breaking text into lines
+        // does not allocate once the buffer has grown to _maxHeight entries.
+        _captionLines.clear();
+
+        // Decode the text once. From here on, indexes and lengths count grapheme clusters.
+        _breakTable.Build(text);
+        auto textLength = _breakTable.Size();
+
+        _wordTimings.Clear();
+        if (_useWordTimings)
         {
-            index = SkipSkippable(text, index);
+            _wordTimings.Build(event.json, _breakTable);
+        }
 
-            int lineLength = GetBestWidth(text, index);
-            captionLines.push_back(StringHelper::Trim(text.substr(index, lineLength)));
-            index = index + lineLength;
+        size_t index = 0;
+        while (index < textLength)
+        {
+            _captionLines.push_back(NextLine(text, index));
 
-            auto isLastCaption = index >= text.length();
-            auto maxCaptionLines = captionLines.size() >= _maxHeight;
+            auto isLastCaption = index >= textLength;
+            auto maxCaptionLines = _captionLines.size() >= _maxHeight;
 
             auto addCaption = isLastCaption || maxCaptionLines;
             if (addCaption)
             {
-                auto captionText = StringHelper::Join(captionLines, "\n");
-                captionLines.clear();
+                auto captionText = StringHelper::Join(_captionLines, "\n");
+                _captionLines.clear();
 
-                auto captionSequence = _captions.value().size() + 1;
+                auto captionSequence = ++_captionSequence;
                 auto isFirstCaption = captionStartsAt == 0;
 
                 auto captionTiming = isFirstCaption && isLastCaption
-                    ? GetFullResultCaptionTiming(result)
-                    : GetPartialResultCaptionTiming(result, text, captionText, captionStartsAt, index - captionStartsAt);
+                    ? GetFullResultCaptionTiming(event)
+                    : GetPartialResultCaptionTiming(event, textLength, captionStartsAt, index - captionStartsAt);
 
-                _captions.value().push_back(Caption(_language, captionSequence, captionTiming.begin, captionTiming.end, captionText));
+                _captions.push_back(Caption(_language, captionSequence, captionTiming.begin, captionTiming.end, std::move(captionText)));
                 
                 captionStartsAt = index;
             }
         }
     }
 
-    int GetBestWidth(std::string text, int startIndex)
+    // Returns the width in grapheme clusters of the line that starts at startIndex.
+    // Precondition: _breakTable was built from the text being broken.
+    size_t GetBestWidth(size_t startIndex)
     {
-        auto remaining = text.length() - startIndex;
-        // Do not use auto for bestWidth, because C++ will assign type uint64_t.
-        // However, FindBestWidth can return -1.
-        int bestWidth = remaining < _maxWidth
-            ? remaining
-            : FindBestWidth(_firstPassTerminators, text, startIndex);
-
-        if (bestWidth < 0)
+        auto remaining = _breakTable.Size() - startIndex;
+        if (remaining < _maxWidth)
         {
-            bestWidth = FindBestWidth(_secondPassTerminators, text, startIndex);
+            return remaining;
         }
 
-        if (bestWidth < 0)
+        auto endIndex = startIndex + _maxWidth;
+        auto bestBreak = _breakTable.LastFirstPassBreak(endIndex);
+        if (bestBreak <= startIndex)
         {
-            bestWidth = _maxWidth;
+            bestBreak = _breakTable.LastSecondPassBreak(endIndex);
         }
 
-        return bestWidth;
+        return bestBreak > startIndex ? bestBreak - startIndex : _maxWidth;
     }
 
-    int FindBestWidth(std::vector<std::string> terminators, std::string text, int startAt)
-    {
-        auto remaining = text.length() - startAt;
-        auto checkChars = remaining < _maxWidth ? remaining : _maxWidth;
-
-        auto bestWidth = -1;
-        for (auto terminator : terminators)
-        {
-            // We need to get the last index of the terminator,
-            // but only searching from startAt to startAt + checkChars.
-            // So we take a substring of text from startAt to
-            // startAt + checkChars.
-            // Afterward, we need to re-add startAt to the resulting
-            // index (which is from the substring) to align it with
-            // the text from which the substring was taken.
-            // Again, do not use auto for index, because find_last_of
-            // can return npos, which is -1.
-            int index = text.substr(startAt, checkChars).find_last_of(terminator) + startAt;
-            int width = index - startAt;
-            if (width > bestWidth)
-            {
-                bestWidth = width + terminator.length();
-            }
-        }
-
-        return bestWidth;
-    }
-
-    int SkipSkippable(std::string text, int startIndex)
+    size_t SkipSkippable(size_t startIndex)
     {
         auto index = startIndex;
-        while (text.length() > index && text[index] == ' ')
+        while (_breakTable.Size() > index && _breakTable.IsSpaceAt(index))
         {
             index++;
         }
@@ -267,24 +441,26 @@ public:
         return index;
     }
     
-    CaptionTiming GetFullResultCaptionTiming(std::shared_ptr<RecognitionResult> result)
+    CaptionTiming GetFullResultCaptionTiming(const RecognitionEvent& event)
     {
-        auto resultBegin = TimestampFromTicks(result->Offset());
-        auto resultEnd = TimestampFromTicks(result->Offset() + result->Duration());
-        return CaptionTiming(resultBegin, resultEnd);
+        return CaptionTiming(event.offset, event.offset + event.duration);
     }
 
-    CaptionTiming GetPartialResultCaptionTiming(std::shared_ptr<RecognitionResult> result, std::string text, std::string captionText, int captionStartsAt, int captionLength)
+    CaptionTiming GetPartialResultCaptionTiming(const RecognitionEvent& event, size_t textLength, size_t captionStartsAt, size_t captionLength)
     {
-        auto captionTiming = GetFullResultCaptionTiming(result);
-        auto msBegin = MillisecondsFromTimestamp(captionTiming.begin);
-        auto msEnd = MillisecondsFromTimestamp(captionTiming.end);
-        auto msDuration = msEnd - msBegin;
-        auto textLength = text.length();
-        // TODO2 Consider something more precise than ms.
-        auto partialBegin = msBegin + msDuration * captionStartsAt / textLength;
-        auto partialEnd = msBegin + msDuration * (captionStartsAt + captionLength) / textLength;
-        return CaptionTiming(TimestampFromMilliseconds(partialBegin), TimestampFromMilliseconds(partialEnd));
+        uint64_t wordsBegin = 0;
+        uint64_t wordsEnd = 0;
+        if (!_wordTimings.Empty() && _wordTimings.TimingForRange(captionStartsAt, captionStartsAt + captionLength, wordsBegin, wordsEnd))
+        {
+            return CaptionTiming(Ticks(wordsBegin), Ticks(wordsEnd));
+        }
+
+        // Without word timings, assume time is spread evenly across the text.
+        auto begin = event.offset.Value();
+        auto duration = event.duration.Value();
+        auto partialBegin = Ticks(begin + duration * captionStartsAt / textLength);
+        auto partialEnd = Ticks(begin + duration * (captionStartsAt + captionLength) / textLength);
+        return CaptionTiming(partialBegin, partialEnd);
     }
 
     static bool IsFinalResult(std::shared_ptr<RecognitionResult> result)
@@ -0,0 +1,256 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "caption_helper.h"
+#include "user_config.h"
+
+// Writes captions in one output format. Each method appends to a buffer that the caller owns and
+// reuses, so once the buffer has grown to the size of a typical caption, serializing does not allocate.
+class CaptionSerializer
+{
+protected:
+
+    static void AppendNumber(std::string& buffer, uint64_t value)
+    {
+        char digits[20];
+        auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        buffer.append(digits, end - digits);
+    }
+
+    static void AppendTimestamp(std::string& buffer, Ticks ticks, bool srt)
+    {
+        char timestamp[timestampBufferSize];
+        auto length = FormatTimestamp(TimestampFromTicks(ticks), srt, timestamp);
+        buffer.append(timestamp, length);
+    }
+
+public:
+
+    virtual ~CaptionSerializer() = default;
+
+    // Appends what comes before the first caption.
+    virtual void WriteHeader(std::string& /*buffer*/)
+    {}
+
+    virtual void WriteCaption(const Caption& caption, std::string& buffer) = 0;
+
+    // Appends what comes after the last caption.
+    virtual void WriteFooter(std::string& /*buffer*/)
+    {}
+
+    // Binary output is not text, so it is written only to the output file.
+    virtual bool IsBinary() const
+    {
+        return false;
+    }
+
+    static std::unique_ptr<CaptionSerializer> Create(CaptionFormat format, const std::string& language);
+};
+
+class WebVttSerializer final : public CaptionSerializer
+{
+public:
+
+    void WriteHeader(std::string& buffer) override
+    {
+        buffer.append("WEBVTT\n\n");
+    }
+
+    void WriteCaption(const Caption& caption, std::string& buffer) override
+    {
+        AppendTimestamp(buffer, caption.begin, false);
+        buffer.append(" --> ");
+        AppendTimestamp(buffer, caption.end, false);
+        buffer.append("\n").append(caption.text).append("\n\n");
+    }
+};
+
+class SubRipSerializer final : public CaptionSerializer
+{
+public:
+
+    void WriteCaption(const Caption& caption, std::string& buffer) override
+    {
+        AppendNumber(buffer, caption.sequence);
+        buffer.append("\n");
+        AppendTimestamp(buffer, caption.begin, true);
+        buffer.append(" --> ");
+        AppendTimestamp(buffer, caption.end, true);
+        buffer.append("\n").append(caption.text).append("\n\n");
+    }
+};
+
+// Timed Text Markup Language, using the IMSC1 text profile. Each caption is a <p> element,
+// with <br/> between lines.
+class TtmlSerializer final : public CaptionSerializer
+{
+private:
+
+    const std::string m_language;
+
+public:
+
+    TtmlSerializer(const std::string& language) : m_language(language)
+    {}
+
+    void WriteHeader(std::string& buffer) override
+    {
+        buffer.append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<tt xmlns=\"http://www.w3.org/ns/ttml\" xmlns:ttp=\"http://www.w3.org/ns/ttml#parameter\" "
+            "ttp:profile=\"http://www.w3.org/ns/ttml/profile/imsc1/text\" xml:lang=\"").append(m_language).append("\">\n"
+            "<body>\n<div>\n");
+    }
+
+    void WriteCaption(const Caption& caption, std::string& buffer) override
+    {
+        buffer.append("<p begin=\"");
+        AppendTimestamp(buffer, caption.begin, false);
+        buffer.append("\" end=\"");
+        AppendTimestamp(buffer, caption.end, false);
+        buffer.append("\">");
+        for (auto c : caption.text)
+        {
+            switch (c)
+            {
+            case '&':
+                buffer.append("&amp;");
+                break;
+            case '<':
+                buffer.append("&lt;");
+                break;
+            case '>':
+                buffer.append("&gt;");
+                break;
+            case '\n':
+                buffer.append("<br/>");
+                break;
+            default:
+                buffer.push_back(c);
+            }
+        }
+        buffer.append("</p>\n");
+    }
+
+    void WriteFooter(std::string& buffer) override
+    {
+        buffer.append("</div>\n</body>\n</tt>\n");
+    }
+};
+
+// One JSON object per line:
+// {"sequence":1,"begin":10000000,"end":25000000,"text":"line 1\nline 2"}
+// "begin" and "end" are in 100-nanosecond ticks.
+class JsonLinesSerializer final : public CaptionSerializer
+{
+public:
+
+    void WriteCaption(const Caption& caption, std::string& buffer) override
+    {
+        static constexpr char hexDigits[] = "0123456789abcdef";
+
+        buffer.append("{\"sequence\":");
+        AppendNumber(buffer, caption.sequence);
+        buffer.append(",\"begin\":");
+        AppendNumber(buffer, caption.begin.Value());
+        buffer.append(",\"end\":");
+        AppendNumber(buffer, caption.end.Value());
+        buffer.append(",\"text\":\"");
+        for (auto c : caption.text)
+        {
+            switch (c)
+            {
+            case '"':
+                buffer.append("\\\"");
+                break;
+            case '\\':
+                buffer.append("\\\\");
+                break;
+            case '\n':
+                buffer.append("\\n");
+                break;
+            default:
+                if ((unsigned char)c < 0x20)
+                {
+                    buffer.append("\\u00");
+                    buffer.push_back(hexDigits[(unsigned char)c >> 4]);
+                    buffer.push_back(hexDigits[c & 0x0F]);
+                }
+                else
+                {
+                    buffer.push_back(c);
+                }
+            }
+        }
+        buffer.append("\"}\n");
+    }
+};
+
+// A compact format that can be read without parsing text. All integers are little-endian.
+// The file starts with the 4 bytes "CAP1". Each caption is then one record:
+//   uint32 length of the rest of the record
+//   uint32 sequence
+//   uint64 begin, in 100-nanosecond ticks
+//   uint64 end, in 100-nanosecond ticks
+//   UTF-8 text, with '\n' between lines, and no terminator
+class BinarySerializer final : public CaptionSerializer
+{
+private:
+
+    static constexpr uint32_t fixedLength = 4 + 8 + 8;
+
+    static void AppendLittleEndian(std::string& buffer, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            buffer.push_back((char)(value >> (i * 8)));
+        }
+    }
+
+public:
+
+    void WriteHeader(std::string& buffer) override
+    {
+        buffer.append("CAP1");
+    }
+
+    void WriteCaption(const Caption& caption, std::string& buffer) override
+    {
+        AppendLittleEndian(buffer, fixedLength + caption.text.length(), 4);
+        AppendLittleEndian(buffer, (uint32_t)caption.sequence, 4);
+        AppendLittleEndian(buffer, caption.begin.Value(), 8);
+        AppendLittleEndian(buffer, caption.end.Value(), 8);
+        buffer.append(caption.text);
+    }
+
+    bool IsBinary() const override
+    {
+        return true;
+    }
+};
+
+inline std::unique_ptr<CaptionSerializer> CaptionSerializer::Create(CaptionFormat format, const std::string& language)
+{
+    switch (format)
+    {
+    case CaptionFormat::SubRip:
+        return std::make_unique<SubRipSerializer>();
+    case CaptionFormat::Ttml:
+        return std::make_unique<TtmlSerializer>(language);
+    case CaptionFormat::JsonLines:
+        return std::make_unique<JsonLinesSerializer>();
+    case CaptionFormat::Binary:
+        return std::make_unique<BinarySerializer>();
+    case CaptionFormat::WebVtt:
+    default:
+        return std::make_unique<WebVttSerializer>();
+    }
+}
@@ -0,0 +1,640 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include "string_helper.h"
+
+// Serves live captions over HTTP to any number of clients, such as browser players.
+// GET /captions with a WebSocket upgrade receives one text message per caption.
+// GET /captions without one receives a Server-Sent Events stream with one event per caption.
+// Each caption is serialized once per protocol into a shared buffer that every client sends from,
+// so publishing a caption does not copy it per client.
+// Publish() only appends to a queue and wakes the server thread, so it never waits for a client.
+// The server keeps the most recent captions for clients that fall behind. A client that falls
+// further behind than that is disconnected, and can reconnect.
+class CaptionServer final
+{
+private:
+
+#if defined(_WIN32)
+    using SocketHandle = SOCKET;
+    using PollDescriptor = WSAPOLLFD;
+    using AddressLength = int;
+    static constexpr SocketHandle invalidSocket = INVALID_SOCKET;
+    static constexpr int sendFlags = 0;
+#else
+    using SocketHandle = int;
+    using PollDescriptor = pollfd;
+    using AddressLength = socklen_t;
+    static constexpr SocketHandle invalidSocket = -1;
+    // Report a closed connection as an error instead of raising SIGPIPE.
+    static constexpr int sendFlags = MSG_NOSIGNAL;
+#endif
+
+    // Captions kept for clients that are behind.
+    static constexpr size_t backlogCaptions = 1024;
+    // Longest request accepted, including headers.
+    static constexpr size_t maxRequestBytes = 8192;
+    static constexpr int pollTimeoutMilliseconds = 1000;
+
+    struct Frame
+    {
+        uint64_t sequence;
+        std::shared_ptr<const std::string> serverSentEvent;
+        std::shared_ptr<const std::string> webSocketMessage;
+    };
+
+    enum class Protocol
+    {
+        // Reading the request.
+        Request,
+        ServerSentEvents,
+        WebSocket,
+        // Sending the response, then closing.
+        Closing
+    };
+
+    struct Client
+    {
+        SocketHandle socket;
+        Protocol protocol = Protocol::Request;
+        std::string request;
+        std::string response;
+        size_t responseSent = 0;
+        // Sequence number of the next caption to send, and how much of it has been sent.
+        uint64_t next = 0;
+        size_t sent = 0;
+        bool closed = false;
+    };
+
+    SocketHandle m_listener = invalidSocket;
+    // A UDP socket connected to itself. Publish() sends to it to wake the server thread.
+    SocketHandle m_wake = invalidSocket;
+    std::atomic<bool> m_stopping = false;
+
+    // Captions published and not yet taken by the server thread.
+    std::mutex m_mutex;
+    std::deque<Frame> m_published;
+    uint64_t m_nextSequence = 0;
+
+    // Owned by the server thread.
+    std::deque<Frame> m_frames;
+    uint64_t m_framesEnd = 0;
+    std::vector<Client> m_clients;
+    std::vector<PollDescriptor> m_descriptors;
+
+    std::thread m_thread;
+
+    static void CloseSocket(SocketHandle socket)
+    {
+#if defined(_WIN32)
+        closesocket(socket);
+#else
+        close(socket);
+#endif
+    }
+
+    void Close()
+    {
+        if (invalidSocket != m_listener)
+        {
+            CloseSocket(m_listener);
+            m_listener = invalidSocket;
+        }
+        if (invalidSocket != m_wake)
+        {
+            CloseSocket(m_wake);
+            m_wake = invalidSocket;
+        }
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+    }
+
+    static bool SetNonBlocking(SocketHandle socket)
+    {
+#if defined(_WIN32)
+        u_long mode = 1;
+        return 0 == ioctlsocket(socket, FIONBIO, &mode);
+#else
+        auto flags = fcntl(socket, F_GETFL, 0);
+        return flags >= 0 && 0 == fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+#endif
+    }
+
+    static bool WouldBlock()
+    {
+#if defined(_WIN32)
+        return WSAEWOULDBLOCK == WSAGetLastError();
+#else
+        return EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno;
+#endif
+    }
+
+    static int Poll(std::vector<PollDescriptor>& descriptors, int timeout)
+    {
+#if defined(_WIN32)
+        return WSAPoll(descriptors.data(), (ULONG)descriptors.size(), timeout);
+#else
+        return poll(descriptors.data(), (nfds_t)descriptors.size(), timeout);
+#endif
+    }
+
+    static std::string Sha1(std::string_view text)
+    {
+        uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+        auto rotate = [](uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); };
+
+        std::string message(text);
+        uint64_t bitLength = (uint64_t)text.length() * 8;
+        message += (char)0x80;
+        while (message.length() % 64 != 56)
+        {
+            message += (char)0;
+        }
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            message += (char)(bitLength >> shift);
+        }
+
+        for (size_t chunk = 0; chunk < message.length(); chunk += 64)
+        {
+            uint32_t w[80];
+            for (int i = 0; i < 16; i++)
+            {
+                auto p = (const unsigned char*)message.data() + chunk + i * 4;
+                w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+            }
+            for (int i = 16; i < 80; i++)
+            {
+                w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; i++)
+            {
+                uint32_t f, k;
+                if (i < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if (i < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if (i < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t temp = rotate(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotate(b, 30);
+                b = a;
+                a = temp;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+
+        std::string retval;
+        for (auto word : h)
+        {
+            for (int shift = 24; shift >= 0; shift -= 8)
+            {
+                retval += (char)(word >> shift);
+            }
+        }
+        return retval;
+    }
+
+    static std::string Base64(std::string_view bytes)
+    {
+        static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string retval;
+        for (size_t i = 0; i < bytes.length(); i += 3)
+        {
+            uint32_t group = (uint32_t)(unsigned char)bytes[i] << 16;
+            if (i + 1 < bytes.length())
+            {
+                group |= (uint32_t)(unsigned char)bytes[i + 1] << 8;
+            }
+            if (i + 2 < bytes.length())
+            {
+                group |= (unsigned char)bytes[i + 2];
+            }
+            retval += alphabet[(group >> 18) & 0x3F];
+            retval += alphabet[(group >> 12) & 0x3F];
+            retval += i + 1 < bytes.length() ? alphabet[(group >> 6) & 0x3F] : '=';
+            retval += i + 2 < bytes.length() ? alphabet[group & 0x3F] : '=';
+        }
+        return retval;
+    }
+
+    // Returns the value of a header in request, or an empty string. lowerRequest is request in lower case.
+    static std::string HeaderValue(const std::string& request, const std::string& lowerRequest, const std::string& lowerName)
+    {
+        auto position = lowerRequest.find("\r\n" + lowerName + ":");
+        if (std::string::npos == position)
+        {
+            return "";
+        }
+        auto begin = position + 3 + lowerName.length();
+        auto end = request.find("\r\n", begin);
+        return std::string(StringHelper::TrimView(std::string_view(request).substr(begin, end - begin)));
+    }
+
+    void HandleRequest(Client& client)
+    {
+        auto lowerRequest = StringHelper::ToLower(client.request);
+        auto isCaptions = StringHelper::StartsWith(lowerRequest, "get /captions ") || StringHelper::StartsWith(lowerRequest, "get /captions?");
+        auto webSocketKey = HeaderValue(client.request, lowerRequest, "sec-websocket-key");
+
+        if (!isCaptions)
+        {
+            client.response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            client.protocol = Protocol::Closing;
+            return;
+        }
+
+        if (StringHelper::CaseInsensitiveCompare(HeaderValue(client.request, lowerRequest, "upgrade"), "websocket") && !webSocketKey.empty())
+        {
+            client.response = "HTTP/1.1 101 Switching Protocols\r\n"
+                "Upgrade: websocket\r\n"
+                "Connection: Upgrade\r\n"
+                "Sec-WebSocket-Accept: " + Base64(Sha1(webSocketKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11")) + "\r\n\r\n";
+            client.protocol = Protocol::WebSocket;
+        }
+        else
+        {
+            client.response = "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Access-Control-Allow-Origin: *\r\n"
+                "Connection: keep-alive\r\n\r\n";
+            client.protocol = Protocol::ServerSentEvents;
+        }
+        // Start with the current caption.
+        client.next = m_frames.empty() ? m_framesEnd : m_framesEnd - 1;
+        client.request.clear();
+        client.request.shrink_to_fit();
+    }
+
+    void Read(Client& client)
+    {
+        char buffer[4096];
+        auto received = recv(client.socket, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            client.closed = received == 0 || !WouldBlock();
+            return;
+        }
+
+        if (Protocol::Request == client.protocol)
+        {
+            client.request.append(buffer, received);
+            if (std::string::npos != client.request.find("\r\n\r\n"))
+            {
+                HandleRequest(client);
+            }
+            else if (client.request.length() > maxRequestBytes)
+            {
+                client.closed = true;
+            }
+        }
+        else if (Protocol::WebSocket == client.protocol && 0x08 == (buffer[0] & 0x0F))
+        {
+            // A close frame. Messages from clients are otherwise ignored.
+            client.closed = true;
+        }
+    }
+
+    bool HasPending(const Client& client) const
+    {
+        return client.responseSent < client.response.length()
+            || ((Protocol::ServerSentEvents == client.protocol || Protocol::WebSocket == client.protocol) && client.next < m_framesEnd);
+    }
+
+    void Write(Client& client)
+    {
+        while (client.responseSent < client.response.length())
+        {
+            auto sent = send(client.socket, client.response.data() + client.responseSent, (int)(client.response.length() - client.responseSent), sendFlags);
+            if (sent < 0)
+            {
+                client.closed = !WouldBlock();
+                return;
+            }
+            client.responseSent += sent;
+        }
+        if (Protocol::Closing == client.protocol)
+        {
+            client.closed = true;
+            return;
+        }
+        if (Protocol::Request == client.protocol)
+        {
+            return;
+        }
+
+        while (client.next < m_framesEnd)
+        {
+            if (m_frames.empty() || client.next < m_frames.front().sequence)
+            {
+                // The client fell too far behind.
+                client.closed = true;
+                return;
+            }
+            const auto& frame = m_frames[(size_t)(client.next - m_frames.front().sequence)];
+            const auto& data = Protocol::WebSocket == client.protocol ? *frame.webSocketMessage : *frame.serverSentEvent;
+            auto sent = send(client.socket, data.data() + client.sent, (int)(data.length() - client.sent), sendFlags);
+            if (sent < 0)
+            {
+                client.closed = !WouldBlock();
+                return;
+            }
+            client.sent += sent;
+            if (client.sent == data.length())
+            {
+                client.next++;
+                client.sent = 0;
+            }
+        }
+    }
+
+    void Accept()
+    {
+        while (true)
+        {
+            auto socket = accept(m_listener, nullptr, nullptr);
+            if (invalidSocket == socket)
+            {
+                return;
+            }
+            if (!SetNonBlocking(socket))
+            {
+                CloseSocket(socket);
+                continue;
+            }
+            Client client;
+            client.socket = socket;
+            m_clients.push_back(std::move(client));
+        }
+    }
+
+    void TakePublished()
+    {
+        char buffer[64];
+        while (recv(m_wake, buffer, sizeof(buffer), 0) > 0)
+        {
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Publish() drops captions the server thread has not taken when it falls behind. Frames are
+        // indexed by sequence number, so start over after a gap.
+        if (!m_published.empty() && !m_frames.empty() && m_published.front().sequence != m_frames.back().sequence + 1)
+        {
+            m_frames.clear();
+        }
+        for (auto& frame : m_published)
+        {
+            m_frames.push_back(std::move(frame));
+        }
+        m_published.clear();
+        m_framesEnd = m_nextSequence;
+        while (m_frames.size() > backlogCaptions)
+        {
+            m_frames.pop_front();
+        }
+    }
+
+    void Run()
+    {
+        while (!m_stopping)
+        {
+            m_descriptors.clear();
+            m_descriptors.push_back({ m_listener, POLLIN, 0 });
+            m_descriptors.push_back({ m_wake, POLLIN, 0 });
+            for (const auto& client : m_clients)
+            {
+                m_descriptors.push_back({ client.socket, (short)(POLLIN | (HasPending(client) ? POLLOUT : 0)), 0 });
+            }
+            auto polledClients = m_clients.size();
+
+            if (Poll(m_descriptors, pollTimeoutMilliseconds) < 0)
+            {
+                continue;
+            }
+
+            auto woken = 0 != (m_descriptors[1].revents & POLLIN);
+            if (woken)
+            {
+                TakePublished();
+            }
+            for (size_t index = 0; index < polledClients; index++)
+            {
+                auto& client = m_clients[index];
+                auto events = m_descriptors[index + 2].revents;
+                if (events & (POLLERR | POLLNVAL))
+                {
+                    client.closed = true;
+                    continue;
+                }
+                if (events & (POLLIN | POLLHUP))
+                {
+                    Read(client);
+                }
+                if (!client.closed && (woken || (events & POLLOUT) || HasPending(client)))
+                {
+                    Write(client);
+                }
+            }
+            if (m_descriptors[0].revents & POLLIN)
+            {
+                Accept();
+            }
+
+            for (auto& client : m_clients)
+            {
+                if (client.closed)
+                {
+                    CloseSocket(client.socket);
+                }
+            }
+            m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [](const Client& client) { return client.closed; }), m_clients.end());
+        }
+    }
+
+    static std::string WebSocketMessage(std::string_view text)
+    {
+        std::string retval;
+        retval.reserve(text.length() + 10);
+        // FIN and text opcode. Messages from a server are not masked.
+        retval += (char)0x81;
+        if (text.length() < 126)
+        {
+            retval += (char)text.length();
+        }
+        else if (text.length() <= 0xFFFF)
+        {
+            retval += (char)126;
+            retval += (char)(text.length() >> 8);
+            retval += (char)text.length();
+        }
+        else
+        {
+            retval += (char)127;
+            for (int shift = 56; shift >= 0; shift -= 8)
+            {
+                retval += (char)((uint64_t)text.length() >> shift);
+            }
+        }
+        retval.append(text);
+        return retval;
+    }
+
+    static std::string ServerSentEvent(std::string_view text)
+    {
+        std::string retval;
+        retval.reserve(text.length() + 16);
+        size_t begin = 0;
+        while (begin <= text.length())
+        {
+            auto end = text.find('\n', begin);
+            if (std::string_view::npos == end)
+            {
+                end = text.length();
+            }
+            retval.append("data: ").append(text.substr(begin, end - begin)).append("\n");
+            begin = end + 1;
+        }
+        retval += '\n';
+        return retval;
+    }
+
+public:
+
+    // Starts serving on port, on all network interfaces.
+    CaptionServer(int port)
+    {
+#if defined(_WIN32)
+        WSADATA data;
+        if (0 != WSAStartup(MAKEWORD(2, 2), &data))
+        {
+            throw std::runtime_error("Failed to initialize Windows Sockets.");
+        }
+#endif
+        m_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        m_wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (invalidSocket == m_listener || invalidSocket == m_wake)
+        {
+            Close();
+            throw std::runtime_error("Failed to create the caption server sockets.");
+        }
+
+        int reuse = 1;
+        setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons((uint16_t)port);
+        if (0 != bind(m_listener, (sockaddr*)&address, sizeof(address)) || 0 != listen(m_listener, SOMAXCONN) || !SetNonBlocking(m_listener))
+        {
+            Close();
+            throw std::runtime_error("Failed to listen on port " + std::to_string(port) + ".");
+        }
+
+        sockaddr_in wakeAddress = {};
+        wakeAddress.sin_family = AF_INET;
+        wakeAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        AddressLength wakeAddressLength = sizeof(wakeAddress);
+        if (0 != bind(m_wake, (sockaddr*)&wakeAddress, sizeof(wakeAddress))
+            || 0 != getsockname(m_wake, (sockaddr*)&wakeAddress, &wakeAddressLength)
+            || 0 != connect(m_wake, (sockaddr*)&wakeAddress, sizeof(wakeAddress))
+            || !SetNonBlocking(m_wake))
+        {
+            Close();
+            throw std::runtime_error("Failed to create the caption server wake socket.");
+        }
+
+        m_thread = std::thread([this] { Run(); });
+    }
+
+    ~CaptionServer()
+    {
+        m_stopping = true;
+        char wake = 0;
+        send(m_wake, &wake, 1, 0);
+        m_thread.join();
+        for (const auto& client : m_clients)
+        {
+            CloseSocket(client.socket);
+        }
+        Close();
+    }
+
+    CaptionServer(const CaptionServer&) = delete;
+    CaptionServer& operator=(const CaptionServer&) = delete;
+
+    // Sends a caption to every connected client. Trailing line breaks are removed.
+    void Publish(std::string_view caption)
+    {
+        while (!caption.empty() && '\n' == caption.back())
+        {
+            caption.remove_suffix(1);
+        }
+        auto serverSentEvent = std::make_shared<const std::string>(ServerSentEvent(caption));
+        auto webSocketMessage = std::make_shared<const std::string>(WebSocketMessage(caption));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_published.push_back({ m_nextSequence++, std::move(serverSentEvent), std::move(webSocketMessage) });
+            if (m_published.size() > backlogCaptions)
+            {
+                m_published.pop_front();
+            }
+        }
+        // If the socket buffer is full, the server thread has wakes pending anyway.
+        char wake = 0;
+        send(m_wake, &wake, 1, 0);
+    }
+};
@@ -11,130 +11,287 @@
 //     - Microsoft.CognitiveServices.Speech.core.dll
 //     - Microsoft.CognitiveServices.Speech.extension.audio.sys.dll
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <exception>
-#include <filesystem>
+#include <future>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <speechapi_cxx.h>
+#include <type_traits>
+#include "audio_pacer.h"
 #include "binary_file_reader.h"
 #include "caption_helper.h"
+#include "caption_serializer.h"
+#include "caption_server.h"
+#include "input_benchmark.h"
+#include "line_history.h"
+#include "output_sink.h"
+#include "pcm_stream_input.h"
+#include "replay.h"
+#include "resampler.h"
+#include "segmented_output.h"
+#include "stream_audio_source.h"
 #include "string_helper.h"
 #include "user_config.h"
 #include "wav_file_reader.h"
+#include "wav_splitter.h"
+#include "worker_pool.h"
 
 using namespace Microsoft::CognitiveServices::Speech;
 using namespace Microsoft::CognitiveServices::Speech::Audio;
 using namespace Microsoft::CognitiveServices::Speech::Speaker;
+using namespace Microsoft::CognitiveServices::Speech::Translation;
 
-// Helper functions.
-template <typename T>
-std::vector<T> concatVectors(std::vector<T>& v1, std::vector<T>& v2)
+#if defined(CAPTIONING_COUNT_ALLOCATIONS)
+// Count allocations for the replay report. See replay.h.
+void* operator new(std::size_t size)
 {
-    if (0 == v1.size())
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* retval = std::malloc(0 == size ? 1 : size))
     {
-        return std::vector<T>(v2);
-    }
-    else if (0 == v2.size())
-    {
-        return std::vector<T>(v1);
-    }
-    else
-    {
-        std::vector<T> retval(v1);
-        retval.insert(retval.end(), v2.begin(), v2.end());
         return retval;
     }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
 }
+#endif
 
 class Captioning
 {
 private:
 
+    // How many recognition results a session can queue before the Speech SDK callback waits.
+    static constexpr size_t serialQueueCapacity = 256;
+    // How often output that is due by time, rather than by the arrival of a result, is checked at most.
+    static constexpr std::chrono::milliseconds outputTickInterval = std::chrono::milliseconds(100);
+
     std::shared_ptr<UserConfig> m_userConfig = NULL;
     std::shared_ptr<AudioStreamFormat> m_format = NULL;
-    std::shared_ptr<BinaryFileReader> m_callback = NULL;
+    // Where audio is read from, for its counters. m_callback may wrap it.
+    std::shared_ptr<AudioSource> m_source = nullptr;
+    std::shared_ptr<PullAudioInputStreamCallback> m_callback = NULL;
     std::shared_ptr<PullAudioInputStream> m_stream = NULL;
+    // With --pcm, audio is pushed to m_pushStream as it arrives.
+    std::shared_ptr<PushAudioInputStream> m_pushStream = NULL;
+    std::unique_ptr<PcmStreamInput> m_pcmInput = nullptr;
+    // With --pace, releases the input at a multiple of real time.
+    std::shared_ptr<AudioPacer> m_pacer = nullptr;
+    std::unique_ptr<OutputSink> m_outputSink = nullptr;
+    std::unique_ptr<CaptionSerializer> m_serializer = nullptr;
+    // Captions are serialized into this buffer, which is reused for every caption.
+    std::string m_captionBuffer;
+    // If set, captions are also written as HLS segments.
+    std::unique_ptr<SegmentedOutput> m_segmentedOutput = nullptr;
+    // The end of the audio in the latest result, and when it arrived, from which OnOutputTick() estimates how
+    // far the stream has advanced since. Before the first result, the stream starts when the session does.
+    Ticks m_audioTime;
+    std::chrono::steady_clock::time_point m_audioTimeArrival = std::chrono::steady_clock::now();
+    // If set, captions are also sent to clients connected to this server.
+    std::unique_ptr<CaptionServer> m_captionServer = nullptr;
+    // If set, recognition events are recorded to a fixture file for --replay.
+    std::unique_ptr<FixtureWriter> m_fixtureWriter = nullptr;
+    // A session without a worker pool that needs m_outputTimer runs its output on this pool of one thread.
+    // It is declared before m_serialQueue, so it is destroyed after it.
+    std::unique_ptr<WorkerPool> m_outputPool = nullptr;
+    // If set, caption formatting and output run on this queue instead of on the Speech SDK callback thread.
+    std::unique_ptr<SerialQueue> m_serialQueue = nullptr;
+    // If set, posts OnOutputTick() to m_serialQueue periodically. Declared after m_serialQueue, so it stops first.
+    std::atomic<bool> m_outputTickPending = false;
+    std::unique_ptr<PeriodicTask> m_outputTimer = nullptr;
+    // If set, this instance recognizes only part of the input file, and keeps its captions for the
+    // instance that split the file instead of writing them.
+    std::optional<AudioSegment> m_segment = std::nullopt;
+    std::vector<Caption> m_segmentCaptions;
+    std::promise<std::optional<std::string>> m_recognitionEnd;
+    std::atomic<bool> m_recognitionEnded = false;
     int m_srtSequenceNumber = 1;
     std::optional<Caption> m_previousCaption = std::nullopt;
-    std::optional<Timestamp> m_previousEndTime = std::nullopt;
+    std::optional<Ticks> m_previousEndTime = std::nullopt;
     bool m_previousResultIsRecognized = false;
-    std::vector<std::string> m_recognizedLines;
-    std::vector<std::shared_ptr<SpeechRecognitionResult>> m_offlineResults;
+    // End of the last Recognizing result that was captioned since the last Recognized result. See IsCoalesced().
+    std::optional<Ticks> m_lastHypothesisEnd = std::nullopt;
+    // The latest Recognizing result that IsCoalesced() skipped, captioned when its window closes.
+    std::optional<RecognitionEvent> m_coalescedEvent = std::nullopt;
+    // The most recent lines from Recognized results, up to the number of lines in a caption.
+    LineHistory m_recognizedLines;
+    // Breaks real-time caption text into lines. Reused for every result.
+    CaptionHelper m_realTimeCaptionHelper;
+    // The lines of the current result, as views into its text.
+    std::vector<std::string_view> m_lineViews;
+    CaptionHelper m_offlineCaptionHelper;
+    // In offline mode, the most recent caption, held back until the start of the next caption is known.
+    std::optional<Caption> m_pendingOfflineCaption = std::nullopt;
+    // The caption held back in m_previousCaption or m_pendingOfflineCaption has already been written to the
+    // HLS segments. See AdvanceSegments().
+    bool m_heldCaptionSegmented = false;
+    // With --translate, one caption track per target language. Each track breaks and writes its
+    // translations on its own SerialQueue, and the tracks share m_trackPool.
+    // m_trackPool is declared first, so it is destroyed after the tracks.
+    std::unique_ptr<WorkerPool> m_trackPool = nullptr;
+    std::vector<std::unique_ptr<Captioning>> m_tracks;
 
-    void WriteToConsole(std::string text)
+    // Both the Canceled and SessionStopped events can end recognition, so only the first one sets the result.
+    void EndRecognition(std::optional<std::string> error)
     {
-        if (!m_userConfig->suppressConsoleOutput)
+        if (!m_recognitionEnded.exchange(true))
         {
-            std::cout << text << std::flush;
+            m_recognitionEnd.set_value(error);
         }
     }
 
-    void WriteToConsoleOrFile(std::string text)
+    void Dispatch(std::function<void()> handler)
     {
-        WriteToConsole(text);
-        if (m_userConfig->outputFile.has_value())
+        if (m_serialQueue)
+        {
+            m_serialQueue->Post(std::move(handler));
+        }
+        else
         {
-            std::ofstream outputStream;
-            outputStream.open(m_userConfig->outputFile.value(), std::ios_base::app);
-            outputStream << text;
-            outputStream.close();
+            handler();
         }
     }
 
-    std::string GetTimestamp(Timestamp startTime, Timestamp endTime)
+    // Sends the translations in result to the caption tracks for their languages.
+    void DispatchToTracks(std::shared_ptr<RecognitionResult> result)
     {
-        return StringFromTimestamp(startTime, m_userConfig->useSubRipTextCaptionFormat) + " --> " + StringFromTimestamp(endTime, m_userConfig->useSubRipTextCaptionFormat);
+        for (auto& track : m_tracks)
+        {
+            auto translation = CaptionHelper::GetTranslation(result, track->m_userConfig->language);
+            if (!translation.has_value() || translation.value().empty())
+            {
+                continue;
+            }
+            auto event = RecognitionEvent::FromResult(result);
+            event.text = std::move(translation.value());
+            track->Dispatch([track = track.get(), event = std::move(event)]()
+                {
+                    track->HandleEvent(event);
+                });
+        }
+    }
+
+    // Translation recognizers report TranslatingSpeech and TranslatedSpeech instead of
+    // RecognizingSpeech and RecognizedSpeech.
+    static bool IsRecognizing(ResultReason reason)
+    {
+        return ResultReason::RecognizingSpeech == reason || ResultReason::TranslatingSpeech == reason;
     }
 
-    std::string StringFromCaption(Caption caption)
+    static bool IsRecognized(ResultReason reason)
     {
-        std::string retval;
-        if (m_userConfig->useSubRipTextCaptionFormat)
+        return ResultReason::RecognizedSpeech == reason || ResultReason::TranslatedSpeech == reason;
+    }
+
+    void WriteToConsole(std::string_view text)
+    {
+        if (!m_userConfig->suppressConsoleOutput)
         {
-            retval += caption.sequence + "\n";
+            // std::cout is flushed in Finish(). When it is a terminal, output appears at each line break.
+            std::cout << text;
+        }
+    }
+
+    void WriteToConsoleOrFile(std::string_view text)
+    {
+        if (!m_serializer->IsBinary())
+        {
+            WriteToConsole(text);
+        }
+        if (m_outputSink)
+        {
+            m_outputSink->Write(text);
+        }
+        if (m_captionServer)
+        {
+            m_captionServer->Publish(text);
         }
-        retval += GetTimestamp(caption.begin, caption.end) + "\n";
-        retval += caption.text + "\n\n";
-        return retval;
     }
 
-    std::string AdjustRealTimeCaptionText(std::string text, bool isRecognizedResult)
+    // Writes the caption text for a result to captionText: the last m_userConfig->lines lines
+    // of the saved Recognized lines followed by the lines of this result.
+    // The cost depends on the length of the result and the number of lines, not on the length of the session,
+    // and once the buffers have grown, this does not allocate.
+    void AdjustRealTimeCaptionText(std::string_view text, bool isRecognizedResult, std::string& captionText)
     {
         // Split the caption text into multiple lines based on maxLineLength and lines.
-        auto captionHelper = std::make_shared<CaptionHelper>(m_userConfig->language, m_userConfig->maxLineLength, m_userConfig->lines, std::vector<std::shared_ptr<RecognitionResult>>());
-        std::vector<std::string> lines = captionHelper->LinesFromText(text);
+        // Only the last lines are needed, both for this caption and for later ones.
+        m_lineViews.clear();
+        m_realTimeCaptionHelper.LinesFromHypothesis(text, m_lineViews);
 
         // Recognizing results can change with each new result, so we do not save previous Recognizing results.
         // Recognized results are final, so we save them in a member value.
-        std::vector<std::string> recognizingLines;
+        size_t recognizingLines = 0;
         if (isRecognizedResult)
         {
-            m_recognizedLines.insert(m_recognizedLines.end(), lines.begin(), lines.end());
+            for (auto line : m_lineViews)
+            {
+                m_recognizedLines.Push(line);
+            }
         }
         else
         {
-            recognizingLines.insert(recognizingLines.end(), lines.begin(), lines.end());
+            recognizingLines = m_lineViews.size();
         }
 
-        std::vector<std::string> combinedLines = concatVectors(m_recognizedLines, recognizingLines);
-        auto combinedLinesSize = combinedLines.size();
-        int takeLast = combinedLinesSize < m_userConfig->lines ? combinedLinesSize : m_userConfig->lines;
-        std::vector<std::string> retval(combinedLines.end() - takeLast, combinedLines.end());
-        return StringHelper::Join(retval, "\n");
+        size_t lines = m_userConfig->lines;
+        size_t takeRecognizing = std::min(recognizingLines, lines);
+        size_t takeRecognized = std::min(m_recognizedLines.Size(), lines - takeRecognizing);
+
+        captionText.clear();
+        for (size_t index = m_recognizedLines.Size() - takeRecognized; index < m_recognizedLines.Size(); index++)
+        {
+            captionText += m_recognizedLines.At(index);
+            captionText += '\n';
+        }
+        for (size_t index = recognizingLines - takeRecognizing; index < recognizingLines; index++)
+        {
+            captionText += m_lineViews[index];
+            captionText += '\n';
+        }
+        // Remove the last line break.
+        if (!captionText.empty())
+        {
+            captionText.pop_back();
+        }
     }
 
-    std::optional<std::string> CaptionFromRealTimeResult(std::shared_ptr<SpeechRecognitionResult> result, bool isRecognizedResult)
+    void WriteCaption(const Caption& caption, bool toSegments = true)
     {
-        std::optional<std::string> retval = std::nullopt;
+        m_captionBuffer.clear();
+        m_serializer->WriteCaption(caption, m_captionBuffer);
+        WriteToConsoleOrFile(m_captionBuffer);
+        if (m_segmentedOutput && toSegments)
+        {
+            m_segmentedOutput->Write(caption);
+        }
+    }
+
+    // Starts a caption for the result, and writes the previous caption, which is now complete.
+    // Returns true if a caption was written.
+    bool CaptionFromRealTimeResult(const RecognitionEvent& event, bool isRecognizedResult)
+    {
+        bool retval = false;
 
-        Timestamp startTime = TimestampFromTicks(result->Offset());
-        Timestamp endTime = TimestampFromTicks(result->Offset() + result->Duration());
+        Ticks startTime = event.offset;
+        Ticks endTime = event.offset + event.duration;
         // If the end timestamp for the previous result is later
         // than the end timestamp for this result, drop the result.
         // This sometimes happens when we receive a lot of Recognizing results close together.
-        if (m_previousEndTime.has_value() && CompareTimestamps(m_previousEndTime.value(), endTime) > 0)
+        if (m_previousEndTime.has_value() && m_previousEndTime.value() > endTime)
         {
             // Do nothing.
         }
@@ -143,10 +300,10 @@ private:
             // Record the end timestamp for this result.
             m_previousEndTime = endTime;
 
-            // Convert the SpeechRecognitionResult to a caption.
+            // Convert the RecognitionEvent to a caption.
             // We are not ready to set the text for this caption.
             // First we need to determine whether to clear m_recognizedLines.
-            auto caption = Caption(m_userConfig->language, m_srtSequenceNumber++, TimestampPlusMilliseconds(startTime, m_userConfig->delay), TimestampPlusMilliseconds(endTime, m_userConfig->delay), "");
+            auto caption = Caption(m_userConfig->language, m_srtSequenceNumber++, startTime + Ticks::FromMilliseconds(m_userConfig->delay), endTime + Ticks::FromMilliseconds(m_userConfig->delay), "");
 
             // If we have a previous caption...
             if (m_previousCaption.has_value())
@@ -157,16 +314,16 @@ private:
                     // Set the end timestamp for the previous caption to the earliest of:
                     // - The end timestamp for the previous caption plus the remain time.
                     // - The start timestamp for the current caption.
-                    Timestamp previousEnd = TimestampPlusMilliseconds(m_previousCaption.value().end, m_userConfig->remainTime);
-                    m_previousCaption.value().end = CompareTimestamps(previousEnd, caption.begin) < 0 ? previousEnd : caption.begin;
+                    Ticks previousEnd = m_previousCaption.value().end + Ticks::FromMilliseconds(m_userConfig->remainTime);
+                    m_previousCaption.value().end = std::min(previousEnd, caption.begin);
                     // If the gap between the original end timestamp for the previous caption
                     // and the start timestamp for the current caption is larger than remainTime,
                     // clear the cached recognized lines.
                     // Note this needs to be done before we call AdjustRealTimeCaptionText
                     // for the current caption, because it uses m_recognizedLines.
-                    if (CompareTimestamps(previousEnd, caption.begin) < 0)
+                    if (previousEnd < caption.begin)
                     {
-                        m_recognizedLines.clear();
+                        m_recognizedLines.Clear();
                     }
                 }
                 // If the previous result was type Recognizing, simply set the start timestamp
@@ -179,13 +336,20 @@ private:
                     caption.begin = m_previousCaption.value().end;
                 }
 
-                retval = std::optional<std::string>{ StringFromCaption(m_previousCaption.value()) };
+                WriteCaption(m_previousCaption.value(), !m_heldCaptionSegmented);
+                retval = true;
             }
 
             // Break the caption text into lines if needed.
-            caption.text = AdjustRealTimeCaptionText(result->Text, isRecognizedResult);
+            // The previous caption has been written, so reuse its text buffer.
+            if (m_previousCaption.has_value())
+            {
+                caption.text.swap(m_previousCaption.value().text);
+            }
+            AdjustRealTimeCaptionText(event.text, isRecognizedResult, caption.text);
             // Save the current caption as the previous caption.
-            m_previousCaption = caption;
+            m_previousCaption = std::move(caption);
+            m_heldCaptionSegmented = false;
             // Save the result type as the previous result type.
             m_previousResultIsRecognized = isRecognizedResult;
         }
@@ -193,48 +357,265 @@ private:
         return retval;
     }
 
-    std::vector<Caption> CaptionsFromOfflineResults()
+    // With --coalesce, Recognizing results are captioned at most once per coalesce window of audio time.
+    // A Recognizing result that ends within the window after the last one that was captioned is skipped,
+    // because a later result, with the same text or more, replaces it. This bounds the rate of caption
+    // formatting and output during bursts of results. Recognized results are never skipped, so no final
+    // text is lost, and the first Recognizing result after one is captioned right away.
+    // The latest skipped result is kept, and captioned when the window closes: by CaptionEvent() before a
+    // result past the window or a Recognized result, or by OnOutputTick() once the audio passes the window.
+    // So the last text of a burst is still captioned, and does not wait for the result that replaces it.
+    bool IsCoalesced(const RecognitionEvent& event)
+    {
+        if (event.isFinal)
+        {
+            m_lastHypothesisEnd = std::nullopt;
+            return false;
+        }
+        if (0 == m_userConfig->coalesce)
+        {
+            return false;
+        }
+
+        auto end = event.offset + event.duration;
+        if (m_lastHypothesisEnd.has_value() && end < m_lastHypothesisEnd.value() + Ticks::FromMilliseconds(m_userConfig->coalesce))
+        {
+            return true;
+        }
+        m_lastHypothesisEnd = end;
+        return false;
+    }
+
+    // Ends the HLS segments before time, how far the stream has advanced.
+    // The caption that is held back until the next one arrives is written with an earlier time, so it holds
+    // the segments back, until the stream passes where it ends if no next caption arrives. It is then written
+    // to the segments with that end, so a pause does not hold back the playlist.
+    void AdvanceSegments(Ticks time)
     {
-        // Although SpeechRecognitionResult inherits RecognitionResult, we cannot pass
-        // std::vector<std::shared_ptr<SpeechRecognitionResult>> as a
-        // std::vector<std::shared_ptr<RecognitionResult>>.
-        std::vector<std::shared_ptr<RecognitionResult>> offlineResults(m_offlineResults.size());
-        std::transform(m_offlineResults.begin(), m_offlineResults.end(), offlineResults.begin(), [](std::shared_ptr<SpeechRecognitionResult> result) {
-            return std::static_pointer_cast<RecognitionResult>(result);
-        });
-        std::vector<Caption> captions = CaptionHelper::GetCaptions(m_userConfig->language, m_userConfig->maxLineLength, m_userConfig->lines, offlineResults);
+        auto& held = CaptioningMode::Offline == m_userConfig->captioningMode ? m_pendingOfflineCaption : m_previousCaption;
+        if (held.has_value() && !m_heldCaptionSegmented)
+        {
+            // A caption from a Recognizing result ends where the next one begins. Others remain for remainTime.
+            auto remains = CaptioningMode::RealTime == m_userConfig->captioningMode && !m_previousResultIsRecognized
+                ? Ticks()
+                : Ticks::FromMilliseconds(m_userConfig->remainTime);
+            auto end = held.value().end + remains;
+            if (time < end)
+            {
+                time = std::min(time, held.value().begin);
+            }
+            else
+            {
+                Caption caption = held.value();
+                caption.end = end;
+                m_segmentedOutput->Write(caption);
+                m_heldCaptionSegmented = true;
+            }
+        }
+        m_segmentedOutput->AdvanceTo(time);
+    }
 
+    // Writes output that is due by time rather than by the arrival of a result. Runs on m_serialQueue.
+    void OnOutputTick()
+    {
+        // Audio arrives no faster than real time since the latest result, so this does not pass the
+        // audio the recognizer has received.
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_audioTimeArrival);
+        auto audioTime = m_audioTime + Ticks::FromMilliseconds((uint64_t)elapsed.count());
+        if (m_coalescedEvent.has_value() && m_lastHypothesisEnd.has_value()
+            && audioTime >= m_lastHypothesisEnd.value() + Ticks::FromMilliseconds(m_userConfig->coalesce))
+        {
+            // Now that the skipped result is captioned, the next window starts from it.
+            m_lastHypothesisEnd = m_coalescedEvent.value().offset + m_coalescedEvent.value().duration;
+            CaptionCoalescedEvent();
+        }
+        if (m_segmentedOutput)
+        {
+            AdvanceSegments(audioTime);
+        }
+        if (m_outputSink)
+        {
+            m_outputSink->FlushIfDue();
+        }
+    }
+
+    // Produces and writes the captions for a Recognizing or Recognized event with text.
+    // Returns the number of captions written.
+    size_t HandleEvent(const RecognitionEvent& event)
+    {
+        if (m_fixtureWriter)
+        {
+            m_fixtureWriter->Write(event);
+        }
+
+        auto retval = CaptionEvent(event);
+        m_audioTime = std::max(m_audioTime, event.offset + event.duration);
+        m_audioTimeArrival = std::chrono::steady_clock::now();
+        if (m_segmentedOutput)
+        {
+            AdvanceSegments(m_audioTime);
+        }
+        return retval;
+    }
+
+    // Implements HandleEvent() for the captioning mode.
+    size_t CaptionEvent(const RecognitionEvent& event)
+    {
+        if (CaptioningMode::Offline == m_userConfig->captioningMode)
+        {
+            if (!event.isFinal)
+            {
+                return 0;
+            }
+            m_offlineCaptionHelper.Push(event);
+            auto captions = m_offlineCaptionHelper.Drain();
+            auto retval = captions.size();
+            if (m_segment.has_value())
+            {
+                for (Caption& caption : captions)
+                {
+                    m_segmentCaptions.push_back(std::move(caption));
+                }
+            }
+            else
+            {
+                WriteOfflineCaptions(std::move(captions));
+            }
+            return retval;
+        }
+        else
+        {
+            if (IsCoalesced(event))
+            {
+                // Assign rather than emplace, so the strings reuse their storage.
+                if (m_coalescedEvent.has_value())
+                {
+                    m_coalescedEvent.value() = event;
+                }
+                else
+                {
+                    m_coalescedEvent = event;
+                }
+                return 0;
+            }
+            // This result is past the window of the skipped one, or is final, so the window has closed.
+            auto retval = CaptionCoalescedEvent();
+            return retval + (CaptionFromRealTimeResult(event, event.isFinal) ? 1 : 0);
+        }
+    }
+
+    // Captions the latest Recognizing result that IsCoalesced() skipped, if any.
+    // Returns the number of captions written.
+    size_t CaptionCoalescedEvent()
+    {
+        if (!m_coalescedEvent.has_value())
+        {
+            return 0;
+        }
+        auto retval = CaptionFromRealTimeResult(m_coalescedEvent.value(), false) ? 1 : 0;
+        m_coalescedEvent = std::nullopt;
+        return retval;
+    }
+
+    // The timer thread only posts to m_serialQueue, so output still runs one task at a time.
+    void StartOutputTimer(std::chrono::milliseconds period)
+    {
+        if (!m_serialQueue)
+        {
+            m_outputPool = std::make_unique<WorkerPool>(1);
+            m_serialQueue = std::make_unique<SerialQueue>(*m_outputPool, serialQueueCapacity);
+        }
+        m_outputTimer = std::make_unique<PeriodicTask>(period, [this]()
+            {
+                // A tick that is still queued behind results covers this one too.
+                if (!m_outputTickPending.exchange(true))
+                {
+                    m_serialQueue->Post([this]()
+                        {
+                            m_outputTickPending = false;
+                            OnOutputTick();
+                        });
+                }
+            });
+    }
+
+    void WriteOfflineCaptions(std::vector<Caption> captions)
+    {
         // In offline mode, all captions come from RecognitionResults of type Recognized.
         // Set the end timestamp for each caption to the earliest of:
         // - The end timestamp for this caption plus the remain time.
         // - The start timestamp for the next caption.
-        for (auto index = 0; index < captions.size() - 1; index++)
+        // So we cannot write a caption until the next caption arrives, or until Finish() is called.
+        for (Caption& caption : captions)
         {
-            Caption caption_1 = captions[index];
-            Caption caption_2 = captions[index + 1];
-            Timestamp end = TimestampPlusMilliseconds(caption_1.end, m_userConfig->remainTime);
-            caption_1.end = CompareTimestamps(end, caption_2.begin) < 0 ? end : caption_2.begin;
+            if (m_pendingOfflineCaption.has_value())
+            {
+                Caption& previousCaption = m_pendingOfflineCaption.value();
+                Ticks end = previousCaption.end + Ticks::FromMilliseconds(m_userConfig->remainTime);
+                previousCaption.end = std::min(end, caption.begin);
+                WriteCaption(previousCaption, !m_heldCaptionSegmented);
+            }
+            m_pendingOfflineCaption = std::move(caption);
+            m_heldCaptionSegmented = false;
         }
-        Caption lastCaption = captions[captions.size() - 1];
-        lastCaption.end = TimestampPlusMilliseconds(lastCaption.end, m_userConfig->remainTime);
-        return captions;
     }
 
     std::shared_ptr<Audio::AudioConfig> AudioConfigFromUserConfig()
     {
-        if (m_userConfig->inputFile.has_value())
+        if (m_userConfig->pcmSource.has_value())
+        {
+            const size_t bytesPerSample = 2;
+            auto blockAlign = bytesPerSample * m_userConfig->pcmChannels;
+            auto sampleRate = m_userConfig->resampleRate.value_or(m_userConfig->pcmSampleRate);
+            m_format = AudioStreamFormat::GetWaveFormatPCM(sampleRate, 16, (uint8_t)m_userConfig->pcmChannels);
+            m_pushStream = AudioInputStream::CreatePushStream(m_format);
+            m_source = std::make_shared<StreamAudioSource>(m_userConfig->pcmSource.value());
+            if (m_userConfig->paceSpeed.has_value())
+            {
+                m_pacer = std::make_shared<AudioPacer>(blockAlign * m_userConfig->pcmSampleRate, m_userConfig->paceSpeed.value());
+            }
+            m_pcmInput = std::make_unique<PcmStreamInput>(m_source, m_pushStream, blockAlign * m_userConfig->pcmSampleRate, blockAlign, m_userConfig->chunkMilliseconds, m_userConfig->audioBufferMilliseconds, sampleRate, m_pacer);
+            return AudioConfig::FromStreamInput(m_pushStream);
+        }
+        else if (m_userConfig->inputFile.has_value())
         {
             if (StringHelper::EndsWith(m_userConfig->inputFile.value(), ".wav"))
             {
-                auto reader = std::make_shared<WavFileReader>(m_userConfig->inputFile.value());
-                m_format = AudioStreamFormat::GetWaveFormatPCM(reader->GetFormat().SamplesPerSec, (uint8_t)reader->GetFormat().BitsPerSample, (uint8_t)reader->GetFormat().Channels);
-                reader->Close();
+                // One reader parses the header and streams only the audio data after it.
+                auto reader = m_segment.has_value()
+                    ? std::make_shared<WavFileReader>(m_userConfig->inputFile.value(), m_segment.value().begin, m_segment.value().length)
+                    : std::make_shared<WavFileReader>(m_userConfig->inputFile.value());
+                // The reader converts other sample formats to 16-bit PCM.
+                if (m_userConfig->inputChannel.has_value())
+                {
+                    reader->SelectChannel(0 == m_userConfig->inputChannel.value() ? WavFileReader::mixChannels : m_userConfig->inputChannel.value() - 1);
+                }
+                reader->SetReadAhead((uint64_t)m_userConfig->readAheadMegabytes * 1024 * 1024);
+                m_source = reader;
+                auto sampleRate = (int)reader->GetFormat().SamplesPerSec;
+                if (m_userConfig->resampleRate.has_value() && m_userConfig->resampleRate.value() != sampleRate)
+                {
+                    m_callback = std::make_shared<ResamplingReader>(reader, sampleRate, m_userConfig->resampleRate.value(), reader->GetOutputChannels());
+                    sampleRate = m_userConfig->resampleRate.value();
+                }
+                else
+                {
+                    m_callback = reader;
+                }
+                m_format = AudioStreamFormat::GetWaveFormatPCM(sampleRate, 16, (uint8_t)reader->GetOutputChannels());
+                if (m_userConfig->paceSpeed.has_value())
+                {
+                    auto blockAlign = sizeof(int16_t) * reader->GetOutputChannels();
+                    m_pacer = std::make_shared<AudioPacer>(blockAlign * sampleRate, m_userConfig->paceSpeed.value());
+                    m_callback = std::make_shared<PacedReader>(m_callback, m_pacer, AudioChunkBytes(blockAlign * sampleRate, blockAlign, m_userConfig->chunkMilliseconds));
+                }
             }
             else
             {
                 m_format = AudioStreamFormat::GetCompressedFormat(m_userConfig->compressedAudioFormat);
+                m_source = std::make_shared<BinaryFileReader>(m_userConfig->inputFile.value());
+                m_callback = m_source;
             }
-            m_callback = std::make_shared<BinaryFileReader>(m_userConfig->inputFile.value());
             m_stream = AudioInputStream::CreatePullStream(m_format, m_callback);
             return AudioConfig::FromStreamInput(m_stream);
         }
@@ -244,10 +625,20 @@ private:
         }
     }
 
-    std::shared_ptr<SpeechConfig> SpeechConfigFromUserConfig()
+    // ConfigType is SpeechConfig, or SpeechTranslationConfig to translate into m_userConfig->targetLanguages.
+    template <class ConfigType>
+    std::shared_ptr<ConfigType> SpeechConfigFromUserConfig()
     {
-        std::shared_ptr<SpeechConfig> speechConfig;
-        speechConfig = SpeechConfig::FromSubscription(m_userConfig->subscriptionKey, m_userConfig->region);
+        std::shared_ptr<ConfigType> speechConfig;
+        speechConfig = ConfigType::FromSubscription(m_userConfig->subscriptionKey, m_userConfig->region);
+
+        if constexpr (std::is_same_v<ConfigType, SpeechTranslationConfig>)
+        {
+            for (const auto& targetLanguage : m_userConfig->targetLanguages)
+            {
+                speechConfig->AddTargetLanguage(targetLanguage);
+            }
+        }
 
         speechConfig->SetProfanity(m_userConfig->profanityOption);
 
@@ -258,70 +649,133 @@ private:
             speechConfig->SetProperty(PropertyId::SpeechServiceResponse_StablePartialResultThreshold, m_userConfig->stablePartialResultThreshold.value());
         }
         
+        if (m_userConfig->useWordTimings)
+        {
+            speechConfig->SetOutputFormat(OutputFormat::Detailed);
+            speechConfig->RequestWordLevelTimestamps();
+        }
+
         speechConfig->SetProperty(PropertyId::SpeechServiceResponse_PostProcessingOption, "TrueText");
         speechConfig->SetSpeechRecognitionLanguage(m_userConfig->language);
         
         return speechConfig;
     }
 
+    template <class RecognizerType>
+    void AddPhraseList(std::shared_ptr<RecognizerType> recognizer)
+    {
+        if (m_userConfig->phraseList.has_value())
+        {
+            auto grammar = PhraseListGrammar::FromRecognizer(recognizer);
+            for (auto phrase : StringHelper::Split(m_userConfig->phraseList.value(), ';')) {
+                grammar->AddPhrase(phrase);
+            }
+        }
+    }
+
 public:
-    Captioning(std::shared_ptr<UserConfig> userConfig)
-        : m_userConfig(userConfig)
+    // If workerPool is not null, caption formatting and output for this session run on it.
+    // If segment is set, only that part of the input file is recognized. See RecognizeParallel().
+    Captioning(std::shared_ptr<UserConfig> userConfig, WorkerPool* workerPool = nullptr, std::optional<AudioSegment> segment = std::nullopt)
+        : m_userConfig(userConfig),
+        m_serializer(CaptionSerializer::Create(userConfig->captionFormat, userConfig->language)),
+        m_segment(segment),
+        m_recognizedLines(userConfig->lines),
+        m_realTimeCaptionHelper(userConfig->language, userConfig->maxLineLength, userConfig->lines),
+        m_offlineCaptionHelper(userConfig->language, userConfig->maxLineLength, userConfig->lines, userConfig->useWordTimings)
     {
+        if (nullptr != workerPool)
+        {
+            m_serialQueue = std::make_unique<SerialQueue>(*workerPool, serialQueueCapacity);
+        }
         if (m_userConfig->outputFile.has_value())
         {
-            std::filesystem::path outputFile { m_userConfig->outputFile.value() };
-            // If the output file exists, truncate it.
-            if (std::filesystem::exists(outputFile))
+            // If the output file exists, it is truncated.
+            m_outputSink = std::make_unique<OutputSink>(m_userConfig->outputFile.value(), m_userConfig->flushCaptions, m_userConfig->flushInterval, m_userConfig->durableOutput, m_serializer->IsBinary());
+        }
+        if (m_userConfig->recordFile.has_value())
+        {
+            m_fixtureWriter = std::make_unique<FixtureWriter>(m_userConfig->recordFile.value());
+        }
+        m_serializer->WriteHeader(m_captionBuffer);
+        if (!m_captionBuffer.empty())
+        {
+            WriteToConsoleOrFile(m_captionBuffer);
+        }
+        if (m_userConfig->segmentDirectory.has_value())
+        {
+            m_segmentedOutput = std::make_unique<SegmentedOutput>(m_userConfig->segmentDirectory.value(), m_userConfig->segmentDuration, m_userConfig->playlistLength, m_userConfig->durableOutput);
+        }
+        // Started after the header is written, so clients receive only captions.
+        if (m_userConfig->servePort > 0)
+        {
+            m_captionServer = std::make_unique<CaptionServer>(m_userConfig->servePort);
+        }
+        if (!m_userConfig->targetLanguages.empty())
+        {
+            m_trackPool = std::make_unique<WorkerPool>(std::min(m_userConfig->targetLanguages.size(), (size_t)m_userConfig->workers));
+            for (const auto& targetLanguage : m_userConfig->targetLanguages)
             {
-                std::ofstream outputStream;
-                outputStream.open(m_userConfig->outputFile.value());
-                outputStream.close();            
+                m_tracks.push_back(std::make_unique<Captioning>(UserConfigForTranslation(m_userConfig, targetLanguage), m_trackPool.get()));
             }
         }
-        if (!m_userConfig->useSubRipTextCaptionFormat)
+        // --flushInterval must write captions, --segments must end segments, and --coalesce must caption the
+        // last result it skipped, even when no result arrives.
+        // Replay handles events on the calling thread and ends without waiting, so it needs no timer.
+        auto flushes = m_outputSink && m_userConfig->flushInterval > 0;
+        auto coalesces = CaptioningMode::RealTime == m_userConfig->captioningMode && m_userConfig->coalesce > 0;
+        if ((flushes || m_segmentedOutput || coalesces) && !m_userConfig->replayFile.has_value())
         {
-            WriteToConsoleOrFile("WEBVTT\n\n");
+            StartOutputTimer(flushes ? std::min(outputTickInterval, std::chrono::milliseconds(m_userConfig->flushInterval)) : outputTickInterval);
         }
     }
 
     std::shared_ptr<SpeechRecognizer> SpeechRecognizerFromUserConfig()
     {
         std::shared_ptr<AudioConfig> audioConfig = AudioConfigFromUserConfig();
-        std::shared_ptr<SpeechConfig> speechConfig = SpeechConfigFromUserConfig();
+        std::shared_ptr<SpeechConfig> speechConfig = SpeechConfigFromUserConfig<SpeechConfig>();
         std::shared_ptr<SpeechRecognizer> speechRecognizer;
 
         speechRecognizer = SpeechRecognizer::FromConfig(speechConfig, audioConfig);
-
-        if (m_userConfig->phraseList.has_value())
-        {
-            auto grammar = PhraseListGrammar::FromRecognizer(speechRecognizer);
-            for (auto phrase : StringHelper::Split(m_userConfig->phraseList.value(), ';')) {
-                grammar->AddPhrase(phrase);
-            }
-        }
+        AddPhraseList(speechRecognizer);
         
         return speechRecognizer;
     }
 
-    std::optional<std::string> RecognizeContinuous(std::shared_ptr<SpeechRecognizer> speechRecognizer)
+    // Recognizes the audio once, and produces captions for the recognized language and for
+    // each of m_userConfig->targetLanguages from the same results.
+    std::shared_ptr<TranslationRecognizer> TranslationRecognizerFromUserConfig()
     {
-        std::promise<std::optional<std::string>> recognitionEnd;
+        std::shared_ptr<AudioConfig> audioConfig = AudioConfigFromUserConfig();
+        std::shared_ptr<SpeechTranslationConfig> speechConfig = SpeechConfigFromUserConfig<SpeechTranslationConfig>();
+        std::shared_ptr<TranslationRecognizer> translationRecognizer;
 
+        translationRecognizer = TranslationRecognizer::FromConfig(speechConfig, audioConfig);
+        AddPhraseList(translationRecognizer);
+
+        return translationRecognizer;
+    }
+
+    // Connects the event handlers and starts continuous recognition.
+    // The returned future becomes ready when recognition ends. Its value is an error message if recognition failed.
+    // RecognizerType is SpeechRecognizer or TranslationRecognizer.
+    template <class RecognizerType>
+    std::future<std::optional<std::string>> StartRecognition(std::shared_ptr<RecognizerType> speechRecognizer)
+    {
         // We only use Recognizing results in real-time mode.
         if (CaptioningMode::RealTime == m_userConfig->captioningMode)
         {
             // Capture variables we will need inside the lambda. See:
             // https://www.cppstories.com/2020/08/lambda-capturing.html/
-            speechRecognizer->Recognizing.Connect([this](const SpeechRecognitionEventArgs& e)
+            speechRecognizer->Recognizing.Connect([this](const auto& e)
                 {
-                    if (ResultReason::RecognizingSpeech == e.Result->Reason && e.Result->Text.length() > 0)
+                    if (IsRecognizing(e.Result->Reason) && e.Result->Text.length() > 0)
                     {
-                        std::optional<std::string> caption = CaptionFromRealTimeResult(e.Result, false);
-                        if (caption.has_value())
-                        {
-                            WriteToConsoleOrFile(caption.value());
-                        }
+                        Dispatch([this, result = e.Result]()
+                            {
+                                HandleEvent(RecognitionEvent::FromResult(result, m_fixtureWriter && m_userConfig->useWordTimings));
+                            });
+                        DispatchToTracks(e.Result);
                     }
                     else if (ResultReason::NoMatch == e.Result->Reason)
                     {
@@ -330,22 +784,15 @@ public:
                 });
         }
 
-        speechRecognizer->Recognized.Connect([this](const SpeechRecognitionEventArgs& e)
+        speechRecognizer->Recognized.Connect([this](const auto& e)
             {
-                if (ResultReason::RecognizedSpeech == e.Result->Reason && e.Result->Text.length() > 0)
+                if (IsRecognized(e.Result->Reason) && e.Result->Text.length() > 0)
                 {
-                    if (CaptioningMode::Offline == m_userConfig->captioningMode)
-                    {
-                        m_offlineResults.push_back(e.Result);
-                    }
-                    else
-                    {
-                        std::optional<std::string> caption = CaptionFromRealTimeResult(e.Result, true);
-                        if (caption.has_value())
+                    Dispatch([this, result = e.Result]()
                         {
-                            WriteToConsoleOrFile(caption.value());
-                        }
-                    }
+                            HandleEvent(RecognitionEvent::FromResult(result, m_userConfig->useWordTimings));
+                        });
+                    DispatchToTracks(e.Result);
                 }
                 else if (ResultReason::NoMatch == e.Result->Reason)
                 {
@@ -353,17 +800,17 @@ public:
                 }
             });
 
-        speechRecognizer->Canceled.Connect([this, &recognitionEnd](const SpeechRecognitionCanceledEventArgs& e)
+        speechRecognizer->Canceled.Connect([this](const auto& e)
             {
                 if (CancellationReason::EndOfStream == e.Reason)
                 {
                     WriteToConsole("End of stream reached.\n");
-                    recognitionEnd.set_value(std::nullopt); // Notify to stop recognition.
+                    EndRecognition(std::nullopt); // Notify to stop recognition.
                 }
                 else if (CancellationReason::CancelledByUser == e.Reason)
                 {
                     WriteToConsole("User canceled request.\n");
-                    recognitionEnd.set_value(std::nullopt); // Notify to stop recognition.
+                    EndRecognition(std::nullopt); // Notify to stop recognition.
                 }
                 else if (CancellationReason::Error == e.Reason)
                 {
@@ -371,27 +818,33 @@ public:
                     error << "Encountered error.\n"
                         << "ErrorCode: " << (int)e.ErrorCode << "\n"
                         << "ErrorDetails: " << e.ErrorDetails << std::endl;
-                    recognitionEnd.set_value(std::optional<std::string>{ error.str() }); // Notify to stop recognition.
+                    EndRecognition(std::optional<std::string>{ error.str() }); // Notify to stop recognition.
                 }
                 else
                 {
                     std::ostringstream error;
                     error << "Request was cancelled for an unrecognized reason: " << (int)e.Reason << std::endl;
-                    recognitionEnd.set_value(std::optional<std::string>{ error.str() }); // Notify to stop recognition.
+                    EndRecognition(std::optional<std::string>{ error.str() }); // Notify to stop recognition.
                 }
             });
 
-        speechRecognizer->SessionStopped.Connect([this, &recognitionEnd](const SessionEventArgs& e)
+        speechRecognizer->SessionStopped.Connect([this](const SessionEventArgs&)
             {
                 WriteToConsole("Session stopped.\n");
-                recognitionEnd.set_value(std::nullopt); // Notify to stop recognition.
+                EndRecognition(std::nullopt); // Notify to stop recognition.
             });
 
         // Starts continuous recognition. Uses StopContinuousRecognitionAsync() to stop recognition.
         speechRecognizer->StartContinuousRecognitionAsync().get();
 
+        return m_recognitionEnd.get_future();
+    }
+
+    template <class RecognizerType>
+    std::optional<std::string> RecognizeContinuous(std::shared_ptr<RecognizerType> speechRecognizer)
+    {
         // Waits for recognition end.
-        std::optional<std::string> result = recognitionEnd.get_future().get();
+        std::optional<std::string> result = StartRecognition(speechRecognizer).get();
 
         // Stops recognition.
         speechRecognizer->StopContinuousRecognitionAsync().get();
@@ -399,27 +852,269 @@ public:
         return result;
     }
 
+    // Splits the input WAV file at quiet points into m_userConfig->parallelSegments segments,
+    // recognizes the segments concurrently, and writes the combined captions.
+    std::optional<std::string> RecognizeParallel()
+    {
+        auto segments = WavSplitter::SplitOnSilence(m_userConfig->inputFile.value(), m_userConfig->parallelSegments);
+
+        std::vector<std::shared_ptr<Captioning>> segmentCaptionings;
+        std::vector<std::shared_ptr<SpeechRecognizer>> speechRecognizers;
+        std::vector<std::future<std::optional<std::string>>> recognitionEnds;
+        std::vector<Ticks> segmentOffsets;
+        for (const auto& segment : segments)
+        {
+            auto captioning = std::make_shared<Captioning>(UserConfigForSession(m_userConfig, m_userConfig->inputFile.value(), std::nullopt), nullptr, segment);
+            auto speechRecognizer = captioning->SpeechRecognizerFromUserConfig();
+            recognitionEnds.push_back(captioning->StartRecognition(speechRecognizer));
+            segmentCaptionings.push_back(captioning);
+            speechRecognizers.push_back(speechRecognizer);
+            segmentOffsets.push_back(Ticks(segment.offset));
+        }
+
+        std::optional<std::string> retval = std::nullopt;
+        std::vector<std::vector<Caption>> segmentCaptions;
+        for (size_t index = 0; index < segments.size(); index++)
+        {
+            std::optional<std::string> error = recognitionEnds[index].get();
+            speechRecognizers[index]->StopContinuousRecognitionAsync().get();
+            if (error.has_value() && !retval.has_value())
+            {
+                retval = error;
+            }
+            segmentCaptions.push_back(std::move(segmentCaptionings[index]->m_segmentCaptions));
+        }
+
+        // Dispatched, because with --flushInterval the output timer can use the output at the same time.
+        Dispatch([this, captions = MergeCaptions(std::move(segmentCaptions), segmentOffsets)]()
+            {
+                WriteOfflineCaptions(captions);
+            });
+        return retval;
+    }
+
+    // Runs recorded events through the same caption path as results from the Speech service,
+    // without connecting to it, and measures the time and allocations spent on each event.
+    ReplayReport Replay(const std::vector<RecognitionEvent>& events)
+    {
+        ReplayReport retval;
+        retval.latencies.reserve(events.size());
+        std::vector<RecognitionEvent> finalEvents;
+
+        auto allocationsBefore = allocationCount.load();
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& event : events)
+        {
+            if (event.text.empty() || (CaptioningMode::Offline == m_userConfig->captioningMode && !event.isFinal))
+            {
+                continue;
+            }
+            auto eventStart = std::chrono::steady_clock::now();
+            retval.captions += HandleEvent(event);
+            retval.latencies.push_back(std::chrono::steady_clock::now() - eventStart);
+        }
+        retval.elapsed = std::chrono::steady_clock::now() - start;
+        retval.allocations = allocationCount.load() - allocationsBefore;
+        retval.events = retval.latencies.size();
+
+        for (const auto& event : events)
+        {
+            if (event.isFinal && !event.text.empty())
+            {
+                finalEvents.push_back(event);
+            }
+        }
+        retval.finalEvents = finalEvents.size();
+        auto batchStart = std::chrono::steady_clock::now();
+        auto batchCaptions = CaptionHelper::GetCaptions(m_userConfig->language, m_userConfig->maxLineLength, m_userConfig->lines, finalEvents);
+        retval.batchElapsed = std::chrono::steady_clock::now() - batchStart;
+        retval.batchCaptions = batchCaptions.size();
+
+        CaptionHelper helper(m_userConfig->language, m_userConfig->maxLineLength, m_userConfig->lines);
+        auto linesStart = std::chrono::steady_clock::now();
+        for (const auto& event : finalEvents)
+        {
+            retval.lines += helper.LinesFromText(event.text).size();
+        }
+        retval.linesElapsed = std::chrono::steady_clock::now() - linesStart;
+
+        ReferenceLineBreaker reference(m_userConfig->language, m_userConfig->maxLineLength);
+        auto referenceLinesStart = std::chrono::steady_clock::now();
+        for (const auto& event : finalEvents)
+        {
+            retval.referenceLines += reference.LinesFromText(event.text).size();
+        }
+        retval.referenceLinesElapsed = std::chrono::steady_clock::now() - referenceLinesStart;
+
+        // Compared apart from the timed loops, so the comparison adds nothing to either time.
+        for (const auto& event : finalEvents)
+        {
+            if (ReferenceLineBreaker::Applies(event.text))
+            {
+                retval.comparedLineResults++;
+                if (helper.LinesFromText(event.text) != reference.LinesFromText(event.text))
+                {
+                    retval.differentLineResults++;
+                }
+            }
+        }
+
+        char timestamp[timestampBufferSize];
+        auto srt = CaptionFormat::SubRip == m_userConfig->captionFormat;
+        auto timestampsStart = std::chrono::steady_clock::now();
+        for (const auto& caption : batchCaptions)
+        {
+            retval.timestampCharacters += FormatTimestamp(TimestampFromTicks(caption.begin), srt, timestamp);
+            retval.timestampCharacters += FormatTimestamp(TimestampFromTicks(caption.end), srt, timestamp);
+        }
+        retval.timestampsElapsed = std::chrono::steady_clock::now() - timestampsStart;
+        retval.timestamps = batchCaptions.size() * 2;
+
+        auto referenceTimestampsStart = std::chrono::steady_clock::now();
+        for (const auto& caption : batchCaptions)
+        {
+            retval.referenceTimestampCharacters += ReferenceStringFromTimestamp(TimestampFromTicks(caption.begin), srt).length();
+            retval.referenceTimestampCharacters += ReferenceStringFromTimestamp(TimestampFromTicks(caption.end), srt).length();
+        }
+        retval.referenceTimestampsElapsed = std::chrono::steady_clock::now() - referenceTimestampsStart;
+
+        // Compare the timestamps of the captions, then a sweep of one million values that steps through every
+        // field and on past 100 hours, in both formats.
+        auto compareTimestamp = [&retval, &timestamp](Ticks ticks, bool srt)
+        {
+            auto ts = TimestampFromTicks(ticks);
+            auto length = FormatTimestamp(ts, srt, timestamp);
+            retval.comparedTimestamps++;
+            if (std::string_view(timestamp, length) != ReferenceStringFromTimestamp(ts, srt))
+            {
+                retval.differentTimestamps++;
+            }
+        };
+        for (const auto& caption : batchCaptions)
+        {
+            compareTimestamp(caption.begin, srt);
+            compareTimestamp(caption.end, srt);
+        }
+        constexpr uint64_t sweepValues = 1000000;
+        // A prime number of milliseconds, so the sweep lands on every millisecond, second and minute value.
+        constexpr uint64_t sweepStepMilliseconds = 1009;
+        for (uint64_t value = 0; value < sweepValues; value++)
+        {
+            auto ticks = Ticks::FromMilliseconds(value * sweepStepMilliseconds);
+            compareTimestamp(ticks, false);
+            compareTimestamp(ticks, true);
+        }
+
+        return retval;
+    }
+
     void Finish()
     {
+        if (m_pcmInput)
+        {
+            auto report = m_pcmInput->Report();
+            m_pcmInput.reset();
+            WriteToConsole(report);
+        }
+        else if (m_source)
+        {
+            WriteToConsole("Audio input: " + m_source->GetCounters().ToString() + ".\n");
+        }
+        if (m_pacer)
+        {
+            WriteToConsole(m_pacer->Report());
+        }
+
+        // Wait for queued results to be written. Recognition has stopped, so no more are queued.
+        m_outputTimer.reset();
+        m_serialQueue.reset();
+
         if (CaptioningMode::Offline == m_userConfig->captioningMode)
         {
-            for (Caption caption : CaptionsFromOfflineResults())
+            // Show the last pending caption, which is actually the last caption.
+            if (m_pendingOfflineCaption.has_value())
             {
-                WriteToConsoleOrFile(StringFromCaption(caption));
+                m_pendingOfflineCaption.value().end = m_pendingOfflineCaption.value().end + Ticks::FromMilliseconds(m_userConfig->remainTime);
+                WriteCaption(m_pendingOfflineCaption.value(), !m_heldCaptionSegmented);
             }
         }
         else if (CaptioningMode::RealTime == m_userConfig->captioningMode)
         {
+            // A skipped result that no later result replaced is the newest text.
+            CaptionCoalescedEvent();
             // Show the last "previous" caption, which is actually the last caption.
             if (m_previousCaption.has_value())
             {
-                m_previousCaption.value().end = TimestampPlusMilliseconds(m_previousCaption.value().end, m_userConfig->remainTime);
-                WriteToConsoleOrFile(StringFromCaption(m_previousCaption.value()));
+                m_previousCaption.value().end = m_previousCaption.value().end + Ticks::FromMilliseconds(m_userConfig->remainTime);
+                WriteCaption(m_previousCaption.value(), !m_heldCaptionSegmented);
+            }
+        }
+
+        if (m_segmentedOutput)
+        {
+            m_segmentedOutput->Finish();
+        }
+
+        // The footer is not a caption, so it is not sent to the caption server.
+        m_captionBuffer.clear();
+        m_serializer->WriteFooter(m_captionBuffer);
+        if (!m_captionBuffer.empty())
+        {
+            if (!m_serializer->IsBinary())
+            {
+                WriteToConsole(m_captionBuffer);
+            }
+            if (m_outputSink)
+            {
+                m_outputSink->Write(m_captionBuffer);
             }
         }
+
+        if (m_outputSink)
+        {
+            m_outputSink->Flush();
+        }
+        for (auto& track : m_tracks)
+        {
+            track->Finish();
+        }
+        std::cout << std::flush;
     }
 };
 
+// Runs one captioning session for each input in the manifest, all in this process.
+// Recognition for all sessions runs concurrently in the Speech SDK, while caption formatting
+// and output for all sessions share one WorkerPool.
+void RunSessions(std::shared_ptr<UserConfig> userConfig)
+{
+    struct Session
+    {
+        std::shared_ptr<UserConfig> userConfig;
+        std::shared_ptr<Captioning> captioning;
+        std::shared_ptr<SpeechRecognizer> speechRecognizer;
+        std::future<std::optional<std::string>> recognitionEnd;
+    };
+
+    // Declared before the sessions, so it is destroyed after them.
+    WorkerPool workerPool(userConfig->workers);
+    std::vector<Session> sessions;
+    for (const auto& sessionConfig : UserConfigsFromManifest(userConfig))
+    {
+        auto captioning = std::make_shared<Captioning>(sessionConfig, &workerPool);
+        auto speechRecognizer = captioning->SpeechRecognizerFromUserConfig();
+        auto recognitionEnd = captioning->StartRecognition(speechRecognizer);
+        sessions.push_back({ sessionConfig, captioning, speechRecognizer, std::move(recognitionEnd) });
+    }
+
+    for (auto& session : sessions)
+    {
+        std::optional<std::string> error = session.recognitionEnd.get();
+        session.speechRecognizer->StopContinuousRecognitionAsync().get();
+        session.captioning->Finish();
+        std::cout << session.userConfig->inputFile.value() << ": " << (error.has_value() ? error.value() : "Done.\n") << std::flush;
+    }
+}
+
 int main(int argc, char* argv[])
 {
     const std::string usage = "Usage: captioning.exe [...]\n\n"
@@ -440,7 +1135,51 @@ int main(int argc, char* argv[])
 "    --format FORMAT                  Use compressed audio format.\n"
 "                                     If this is not present, uncompressed format (wav) is assumed.\n"
 "                                     Valid only with --file.\n"
-"                                     Valid values: alaw, any, flac, mp3, mulaw, ogg_opus\n\n"
+"                                     Valid values: alaw, any, flac, mp3, mulaw, ogg_opus\n"
+"    --readAhead MEGABYTES            Keep MEGABYTES of a WAV --input file in memory ahead of the recognizer, for slow\n"
+"                                     or networked storage. Default is 0 (the system's own read-ahead only).\n"
+"    --benchmarkInput                 Read the WAV --input file with the fstream and memory-mapped readers, in reads of\n"
+"                                     --chunk milliseconds of audio, and report throughput instead of recognizing it.\n"
+"                                     Does not connect to the Speech service, so --key and --region are not needed.\n"
+"    --inputChannel CHANNEL           Recognize one channel of a multichannel WAV --input file: a number from 1, or mix\n"
+"                                     to mix all the channels. By default all the channels are passed to the recognizer.\n"
+"    --sampleRate HZ                  Resample WAV --input or --pcm audio to HZ before it is recognized, for example\n"
+"                                     44.1 or 48 kHz audio to 16000. Minimum is 8000. By default audio is not resampled.\n"
+"    --pace SPEED                     Release WAV --input or --pcm audio at SPEED times real time, as a live source would,\n"
+"                                     to test latency and endpointing with files. SPEED is a number such as 1 or 2, or\n"
+"                                     max. Minimum is 0.1. Default is max, as fast as the input can be read.\n"
+"    --pcm SOURCE                     Input raw 16-bit little-endian PCM from SOURCE instead of a file or the microphone.\n"
+"                                     SOURCE is - for standard input, or the path of a UNIX domain socket to listen on\n"
+"                                     for one client, such as an encoder. Not valid with --input.\n"
+"    --pcmRate HZ                     Sample rate of --pcm audio. Default is 16000.\n"
+"    --pcmChannels COUNT              Number of channels of --pcm audio. Default is 1.\n"
+"    --chunk MILLISECONDS             Push --pcm audio, or release --pace audio, to the recognizer in chunks of\n"
+"                                     MILLISECONDS.\n"
+"                                     Smaller chunks lower latency. Minimum is 10. Maximum is 1000. Default is 100.\n"
+"    --audioBuffer MILLISECONDS       How much --pcm audio to hold between the reader and the recognizer before\n"
+"                                     dropping audio. Minimum is twice --chunk. Default is 2000.\n\n"
+"  SESSIONS\n"
+"    --manifest FILE                  Caption several inputs in one process. FILE is a JSON array of\n"
+"                                     { \"input\": FILE, \"output\": FILE } objects, one per session.\n"
+"                                     Other options apply to every session. Overrides --input and --output.\n"
+"    --workers COUNT                  Number of threads that format and write captions for all sessions.\n"
+"                                     Default is the number of processors.\n\n"
+"  REPLAY\n"
+"    --record FILE                    Record recognition events to FILE, one JSON object per line.\n"
+"                                     Not valid with --manifest or --parallel.\n"
+"    --replay FILE                    Caption events recorded with --record instead of recognizing audio, and\n"
+"                                     report latency per event, throughput and the time spent breaking lines and\n"
+"                                     formatting timestamps. Builds with CAPTIONING_COUNT_ALLOCATIONS defined also\n"
+"                                     report allocations per caption.\n"
+"                                     Does not connect to the Speech service, so --key and --region are not needed.\n\n"
+"  PARALLEL\n"
+"    --parallel COUNT                 Split a WAV input file at quiet points into COUNT segments and recognize them\n"
+"                                     concurrently. Valid only with --offline and a 16-bit PCM --input file.\n\n"
+"  TRANSLATION\n"
+"    --translate ""LANG1;LANG2""          Also caption translations into each target language, from the same recognition.\n"
+"                                     Each language is written to the --output file with the language inserted\n"
+"                                     before the extension, for example captions.de.vtt. Requires --output.\n"
+"                                     Examples: ""de;fr"", ""zh-Hans""\n\n"
 "  MODE\n"
 "    --offline                        Output offline results.\n"
 "                                     Overrides --realTime.\n"
@@ -451,18 +1190,38 @@ int main(int argc, char* argv[])
 "  OUTPUT\n"
 "    --output FILE                    Output captions to text file.\n"
 "    --srt                            Output captions in SubRip Text format (default format is WebVTT.)\n"
+"    --captionFormat FORMAT           Output captions in FORMAT. Overrides --srt.\n"
+"                                     Valid values: vtt (default), srt, ttml (IMSC1), jsonl (JSON Lines),\n"
+"                                     binary (length-prefixed records; written only to the --output file).\n"
 "    --maxLineLength LENGTH           Set the maximum number of characters per line for a caption to LENGTH.\n"
-"                                     Minimum is 20. Default is 37 (30 for Chinese).\n"
+"                                     Minimum is 20. Default is 37 (30 for Chinese, Japanese and Korean).\n"
+"                                     Characters are counted as user-perceived characters, not bytes.\n"
+"    --flushCaptions COUNT            Write captions to the output file in batches of COUNT.\n"
+"                                     Minimum is 1. Default is 1.\n"
+"    --flushInterval MILLISECONDS     Also write pending captions to the output file MILLISECONDS after the last\n"
+"                                     write, even if no other caption arrives. Default is 0 (disabled).\n"
+"    --durable                        Sync the output file to disk each time captions are written to it.\n"
+"    --segments DIRECTORY             Also write captions to DIRECTORY as WebVTT segment files with an HLS playlist,\n"
+"                                     captions.m3u8, that lists the most recent segments.\n"
+"    --segmentDuration SECONDS        Duration of each segment. Minimum is 1. Default is 6.\n"
+"    --playlistLength COUNT           Number of segments in the playlist. Minimum is 1. Default is 10.\n"
+"    --serve PORT                     Also serve captions at http://HOST:PORT/captions, on all network interfaces,\n"
+"                                     as Server-Sent Events, or as WebSocket messages if the request is a WebSocket upgrade.\n"
 "    --lines LINES                    Set the number of lines for a caption to LINES.\n"
 "                                     Minimum is 1. Default is 2.\n"
 "    --delay MILLISECONDS             How many MILLISECONDS to delay the appearance of each caption.\n"
 "                                     Minimum is 0.0. Default is 1000.\n"
 "    --remainTime MILLISECONDS        How many MILLISECONDS a caption should remain on screen if it is not replaced by another.\n"
-"                                     Minimum is 0.0. Default is 1000.\n\n"
+"                                     Minimum is 0.0. Default is 1000.\n"
+"    --coalesce MILLISECONDS          In real-time mode, skip Recognizing results that end within MILLISECONDS of audio after\n"
+"                                     the last one output. The latest one skipped is output when that much audio has passed.\n"
+"                                     Recognized results are always output. Default is 0 (every result).\n\n"
 "    --quiet                          Suppress console output, except errors.\n"
 "    --profanity OPTION               Valid values: raw, remove, mask\n"
 "    --threshold NUMBER               Set stable partial result threshold.\n"
-"                                     Default value: 3\n";
+"                                     Default value: 3\n"
+"    --wordTimings                    Request word level timestamps and align offline captions to word boundaries.\n"
+"                                     Otherwise, caption timing assumes speech is spread evenly across characters.\n";
 
     try
     {
@@ -473,9 +1232,42 @@ int main(int argc, char* argv[])
         else
         {
             std::shared_ptr<UserConfig> userConfig = UserConfigFromArgs(argc, argv, usage);
+            if (userConfig->manifestFile.has_value())
+            {
+                RunSessions(userConfig);
+                return 0;
+            }
+            if (userConfig->replayFile.has_value())
+            {
+                auto events = EventsFromFixture(userConfig->replayFile.value());
+                auto captioning = std::make_shared<Captioning>(userConfig);
+                auto report = captioning->Replay(events);
+                captioning->Finish();
+                std::cout << report.ToString() << std::flush;
+                return 0;
+            }
+            if (userConfig->benchmarkInput)
+            {
+                auto report = BenchmarkInput(userConfig->inputFile.value(), userConfig->chunkMilliseconds, (uint64_t)userConfig->readAheadMegabytes * 1024 * 1024, userConfig->resampleRate);
+                std::cout << report.ToString() << std::flush;
+                return 0;
+            }
             auto captioning = std::make_shared<Captioning>(userConfig);
-            std::shared_ptr<SpeechRecognizer> speechRecognizer = captioning->SpeechRecognizerFromUserConfig();
-            std::optional<std::string> error = captioning->RecognizeContinuous(speechRecognizer);
+            std::optional<std::string> error = std::nullopt;
+            if (userConfig->parallelSegments > 1 && CaptioningMode::Offline == userConfig->captioningMode
+                && userConfig->inputFile.has_value() && StringHelper::EndsWith(userConfig->inputFile.value(), ".wav"))
+            {
+                error = captioning->RecognizeParallel();
+            }
+            else if (!userConfig->targetLanguages.empty())
+            {
+                error = captioning->RecognizeContinuous(captioning->TranslationRecognizerFromUserConfig());
+            }
+            else
+            {
+                std::shared_ptr<SpeechRecognizer> speechRecognizer = captioning->SpeechRecognizerFromUserConfig();
+                error = captioning->RecognizeContinuous(speechRecognizer);
+            }
             if (error.has_value())
             {
                 std::cout << error.value() << std::endl;
@@ -484,7 +1276,7 @@ int main(int argc, char* argv[])
             
         }
     }
-    catch (std::exception e)
+    catch (const std::exception& e)
     {
         std::cout << e.what() << std::endl;
     }
@@ -0,0 +1,173 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "audio_source.h"
+#include "binary_file_reader.h"
+#include "resampler.h"
+#include "wav_file_reader.h"
+
+// The result of reading a WAV file with each of the file readers. See BenchmarkInput().
+struct InputBenchmarkReport
+{
+    uint64_t fileBytes = 0;
+    size_t readSize = 0;
+    int rounds = 0;
+    // The fastest round for each reader.
+    std::chrono::nanoseconds fstreamElapsed = std::chrono::nanoseconds::max();
+    std::chrono::nanoseconds mappedElapsed = std::chrono::nanoseconds::max();
+    // Reading a copy of the file that is already in memory, which is as fast as any reader can be.
+    std::chrono::nanoseconds memoryElapsed = std::chrono::nanoseconds::max();
+    // Only set when the input is also resampled. See BenchmarkInput().
+    std::optional<int> resampleRate;
+    double audioSeconds = 0;
+    std::chrono::nanoseconds resampledElapsed = std::chrono::nanoseconds::max();
+    double resamplerSnr = 0;
+    // Sum of the bytes read, so the reads cannot be optimized away.
+    uint64_t checksum = 0;
+
+    std::string ToString() const
+    {
+        auto megabytesPerSecond = [this](std::chrono::nanoseconds elapsed)
+        {
+            return elapsed.count() > 0 ? fileBytes / 1e6 / (elapsed.count() / 1e9) : 0.0;
+        };
+
+        std::ostringstream retval;
+        retval.setf(std::ios::fixed);
+        retval.precision(2);
+        retval << "Read " << fileBytes << " bytes in " << readSize << "-byte reads, best of " << rounds << " rounds:\n"
+            << "BinaryFileReader (fstream): " << fstreamElapsed.count() / 1e6 << " ms, " << megabytesPerSecond(fstreamElapsed) << " MB/s.\n"
+            << "WavFileReader (mapped): " << mappedElapsed.count() / 1e6 << " ms, " << megabytesPerSecond(mappedElapsed) << " MB/s.\n"
+            << "MemoryAudioSource: " << memoryElapsed.count() / 1e6 << " ms, " << megabytesPerSecond(memoryElapsed) << " MB/s.\n";
+        if (resampleRate.has_value())
+        {
+            retval << "WavFileReader resampled to " << resampleRate.value() << " Hz: " << resampledElapsed.count() / 1e6 << " ms, "
+                << audioSeconds / (resampledElapsed.count() / 1e9) << " times real time.\n"
+                << "Signal-to-noise ratio of a resampled 1 kHz tone: " << resamplerSnr << " dB.\n";
+        }
+        return retval.str();
+    }
+};
+
+// Resamples a 1 kHz tone at half of full scale from inputRate to outputRate, and returns the ratio, in dB, of
+// the tone in the output to everything else in it: noise, distortion and aliasing.
+// The tone is found by fitting a sine and cosine of 1 kHz to the output by least squares, so the delay
+// of the filter does not matter. The first and last tenth of a second, where the filter starts and
+// stops, are left out.
+inline double ResamplerSnr(int inputRate, int outputRate)
+{
+    constexpr double frequency = 1000;
+    constexpr double pi = 3.14159265358979323846;
+    const size_t inputFrames = inputRate * 2;
+    std::vector<uint8_t> input(inputFrames * sizeof(int16_t));
+    for (size_t i = 0; i < inputFrames; i++)
+    {
+        StoreInt16(input.data(), i, (int32_t)std::lround(16384 * std::sin(2 * pi * frequency * i / inputRate)));
+    }
+    Resampler resampler(inputRate, outputRate, 1);
+    std::vector<uint8_t> output(resampler.GetMaxOutputFrames(inputFrames) * sizeof(int16_t));
+    auto outputFrames = resampler.Process(input.data(), inputFrames, output.data());
+
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, yy = 0;
+    for (size_t i = outputRate / 10; i + outputRate / 10 < outputFrames; i++)
+    {
+        auto s = std::sin(2 * pi * frequency * i / outputRate);
+        auto c = std::cos(2 * pi * frequency * i / outputRate);
+        double y = LoadInt16(output.data(), i);
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += y * s;
+        yc += y * c;
+        yy += y * y;
+    }
+    auto determinant = ss * cc - sc * sc;
+    auto a = (ys * cc - yc * sc) / determinant;
+    auto b = (yc * ss - ys * sc) / determinant;
+    auto signal = a * a * ss + 2 * a * b * sc + b * b * cc;
+    return 10 * std::log10(signal / (yy - signal));
+}
+
+// Reads the whole of a WAV file the way the Speech SDK does, with repeated calls to
+// PullAudioInputStreamCallback::Read() of readMilliseconds of audio each, with the fstream reader
+// and with the memory-mapped reader, and from memory, and reports the fastest of several rounds for each.
+// The first round also brings the file into the page cache, so the best rounds compare the cost of the
+// readers themselves rather than of the storage device.
+// If resampleRate is set, it also times reading through a ResamplingReader, and reports ResamplerSnr().
+inline InputBenchmarkReport BenchmarkInput(const std::string& fileName, int readMilliseconds, uint64_t readAheadBytes, std::optional<int> resampleRate, int rounds = 5)
+{
+    InputBenchmarkReport retval;
+    retval.rounds = rounds;
+    retval.resampleRate = resampleRate;
+    WavFormat format = {};
+    {
+        WavFileReader reader(fileName);
+        format = reader.GetFormat();
+        retval.audioSeconds = (double)reader.GetDataSize() / std::max<uint32_t>(1, format.AvgBytesPerSec);
+        auto blockAlign = std::max<size_t>(1, format.BlockAlign);
+        retval.readSize = AudioChunkBytes(format.AvgBytesPerSec, blockAlign, readMilliseconds);
+    }
+    std::vector<uint8_t> buffer(retval.readSize);
+    std::ifstream file(fileName, std::ios::binary);
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    auto readAll = [&buffer, &retval](PullAudioInputStreamCallback& reader)
+    {
+        uint64_t bytes = 0;
+        int length = 0;
+        while ((length = reader.Read(buffer.data(), (uint32_t)buffer.size())) > 0)
+        {
+            bytes += length;
+            retval.checksum += buffer[0] + buffer[length - 1];
+        }
+        return bytes;
+    };
+
+    for (int round = 0; round < rounds; round++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        BinaryFileReader fstreamReader(fileName);
+        retval.fileBytes = readAll(fstreamReader);
+        retval.fstreamElapsed = std::min(retval.fstreamElapsed, std::chrono::steady_clock::now() - start);
+
+        start = std::chrono::steady_clock::now();
+        WavFileReader mappedReader(fileName);
+        mappedReader.SetReadAhead(readAheadBytes);
+        readAll(mappedReader);
+        retval.mappedElapsed = std::min(retval.mappedElapsed, std::chrono::steady_clock::now() - start);
+
+        // The copy of the contents is not timed.
+        MemoryAudioSource memorySource(contents);
+        start = std::chrono::steady_clock::now();
+        readAll(memorySource);
+        retval.memoryElapsed = std::min(retval.memoryElapsed, std::chrono::steady_clock::now() - start);
+
+        if (resampleRate.has_value())
+        {
+            start = std::chrono::steady_clock::now();
+            auto source = std::make_shared<WavFileReader>(fileName);
+            source->SetReadAhead(readAheadBytes);
+            ResamplingReader resamplingReader(source, (int)format.SamplesPerSec, resampleRate.value(), format.Channels);
+            readAll(resamplingReader);
+            retval.resampledElapsed = std::min(retval.resampledElapsed, std::chrono::steady_clock::now() - start);
+        }
+    }
+    if (resampleRate.has_value())
+    {
+        retval.resamplerSnr = ResamplerSnr((int)format.SamplesPerSec, resampleRate.value());
+    }
+    return retval;
+}
@@ -0,0 +1,58 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The most recent lines of caption text, up to a fixed number. Adding a line when the history is
+// full replaces the oldest line. Each slot keeps its string between uses, so once the slots have
+// grown to the length of a typical line, adding a line does not allocate.
+class LineHistory final
+{
+private:
+
+    std::vector<std::string> m_slots;
+    // Index of the oldest line.
+    size_t m_first = 0;
+    size_t m_size = 0;
+
+public:
+
+    LineHistory(size_t capacity) : m_slots(capacity > 0 ? capacity : 1)
+    {}
+
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+    // Returns the line at index, where 0 is the oldest line.
+    const std::string& At(size_t index) const
+    {
+        return m_slots[(m_first + index) % m_slots.size()];
+    }
+
+    void Push(std::string_view line)
+    {
+        if (m_size < m_slots.size())
+        {
+            m_slots[(m_first + m_size) % m_slots.size()].assign(line);
+            m_size++;
+        }
+        else
+        {
+            m_slots[m_first].assign(line);
+            m_first = (m_first + 1) % m_slots.size();
+        }
+    }
+
+    void Clear()
+    {
+        m_first = 0;
+        m_size = 0;
+    }
+};
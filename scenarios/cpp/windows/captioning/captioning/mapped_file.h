@@ -0,0 +1,238 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#if defined(_WIN32)
+// Without this, windows.h includes winsock.h, which conflicts with winsock2.h in caption_server.h and
+// stream_audio_source.h when this header is included first.
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only view of a file in memory. Pages are read from the file when they are first used,
+// so opening a large file is cheap, and reading from the view does not copy through a stream buffer.
+// The file is expected to be read once from start to end, which lets the system read further ahead
+// and drop pages that have been read sooner.
+// In 64-bit builds the whole file is mapped once. In 32-bit builds a file larger than windowBytes, such
+// as an RF64 file over 4 GB, cannot fit in the address space, so it is mapped a window at a time, and
+// View() moves the window when it is asked for a range outside it.
+class MappedFile final
+{
+private:
+
+    // Size of each window, in 32-bit builds.
+    static constexpr uint64_t windowBytes = 64 * 1024 * 1024;
+
+    uint64_t m_size = 0;
+    // The mapped range of the file. It is a cache of the file, so View() can move it in const methods.
+    mutable const uint8_t* m_view = nullptr;
+    mutable uint64_t m_viewOffset = 0;
+    mutable uint64_t m_viewSize = 0;
+#if defined(_WIN32)
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = NULL;
+#else
+    int m_file = -1;
+#endif
+
+    static uint64_t MaxViewBytes()
+    {
+        return sizeof(size_t) >= sizeof(uint64_t) ? UINT64_MAX : windowBytes;
+    }
+
+    // Windows must start at a multiple of this.
+    static uint64_t Granularity()
+    {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+#else
+        return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    void Unmap() const
+    {
+        if (nullptr != m_view)
+        {
+#if defined(_WIN32)
+            UnmapViewOfFile(m_view);
+#else
+            munmap((void*)m_view, (size_t)m_viewSize);
+#endif
+        }
+        m_view = nullptr;
+        m_viewOffset = 0;
+        m_viewSize = 0;
+    }
+
+    // Maps length bytes of the file, starting at offset, which is a multiple of Granularity().
+    void Map(uint64_t offset, uint64_t length) const
+    {
+        Unmap();
+#if defined(_WIN32)
+        auto view = MapViewOfFile(m_mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, (SIZE_T)length);
+        m_view = (const uint8_t*)view;
+#else
+        auto view = mmap(nullptr, (size_t)length, PROT_READ, MAP_PRIVATE, m_file, (off_t)offset);
+        m_view = MAP_FAILED == view ? nullptr : (const uint8_t*)view;
+#endif
+        if (nullptr == m_view)
+        {
+            throw std::runtime_error("Failed to map the audio file into memory.");
+        }
+        m_viewOffset = offset;
+        m_viewSize = length;
+#if !defined(_WIN32)
+        // On Windows, FILE_FLAG_SEQUENTIAL_SCAN gives the same hint.
+        madvise((void*)m_view, (size_t)m_viewSize, MADV_SEQUENTIAL);
+#endif
+    }
+
+    void Close()
+    {
+        Unmap();
+#if defined(_WIN32)
+        if (NULL != m_mapping)
+        {
+            CloseHandle(m_mapping);
+        }
+        if (INVALID_HANDLE_VALUE != m_file)
+        {
+            CloseHandle(m_file);
+        }
+#else
+        if (m_file >= 0)
+        {
+            close(m_file);
+        }
+#endif
+    }
+
+public:
+
+    MappedFile(const std::string& fileName)
+    {
+        if (fileName.empty())
+        {
+            throw std::invalid_argument("Audio filename is empty");
+        }
+
+#if defined(_WIN32)
+        m_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+        if (INVALID_HANDLE_VALUE == m_file || !GetFileSizeEx(m_file, &size))
+        {
+            Close();
+            throw std::invalid_argument("Failed to open the specified audio file.");
+        }
+        m_size = (uint64_t)size.QuadPart;
+        if (m_size > 0)
+        {
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        }
+#else
+        m_file = open(fileName.c_str(), O_RDONLY);
+        struct stat status;
+        if (m_file < 0 || 0 != fstat(m_file, &status))
+        {
+            Close();
+            throw std::invalid_argument("Failed to open the specified audio file.");
+        }
+        m_size = (uint64_t)status.st_size;
+#endif
+        try
+        {
+#if defined(_WIN32)
+            if (m_size > 0 && NULL == m_mapping)
+            {
+                throw std::runtime_error("Failed to map the audio file into memory.");
+            }
+#endif
+            if (m_size > 0)
+            {
+                Map(0, std::min(m_size, MaxViewBytes()));
+            }
+        }
+        catch (...)
+        {
+            Close();
+            throw;
+        }
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns the length bytes of the file that start at offset, which must be within the file.
+    // The pointer is valid until the next call to View().
+    const uint8_t* View(uint64_t offset, uint64_t length) const
+    {
+        if (offset < m_viewOffset || offset + length > m_viewOffset + m_viewSize)
+        {
+            auto start = offset - offset % Granularity();
+            Map(start, std::min(m_size - start, std::max(windowBytes, offset + length - start)));
+        }
+        return m_view + (offset - m_viewOffset);
+    }
+
+    uint64_t Size() const
+    {
+        return m_size;
+    }
+
+    // Starts reading length bytes at offset into memory, without waiting for them.
+    // This is only a hint, so failures are ignored, and so is the part of the range outside the view.
+    void Prefetch(uint64_t offset, uint64_t length)
+    {
+        if (offset < m_viewOffset || offset >= m_viewOffset + m_viewSize)
+        {
+            return;
+        }
+        length = std::min(length, m_viewOffset + m_viewSize - offset);
+        auto viewPosition = offset - m_viewOffset;
+#if defined(_WIN32)
+        WIN32_MEMORY_RANGE_ENTRY range = { (PVOID)(m_view + viewPosition), (SIZE_T)length };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        // madvise() requires an address at the start of a page. The view starts at one.
+        static const uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+        auto pagePosition = viewPosition - viewPosition % pageSize;
+        madvise((void*)(m_view + pagePosition), (size_t)(length + viewPosition - pagePosition), MADV_WILLNEED);
+#endif
+    }
+
+    // Asks the system to back the view with huge pages where it can, which lowers the cost of
+    // page faults for large files. Not all systems support this for files, so it is only a hint.
+    void AdviseHugePages()
+    {
+#if defined(MADV_HUGEPAGE)
+        if (nullptr != m_view)
+        {
+            madvise((void*)m_view, (size_t)m_viewSize, MADV_HUGEPAGE);
+        }
+#endif
+    }
+};
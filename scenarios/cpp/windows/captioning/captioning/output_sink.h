@@ -0,0 +1,158 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#if defined(_MSC_VER)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Writes captions to a file that stays open for the whole session. Writes are collected in a
+// fixed-size buffer and written out when the buffer fills, after a number of captions, or when
+// a time interval has passed since the last flush, whichever comes first. The interval is
+// checked when a caption is written, and by FlushIfDue(), which the owner calls periodically so
+// captions before a pause are not held until the next one. Call Flush() at the end of the session.
+// In durable mode, each flush also waits for the data to reach the storage device, and throws if it does not.
+// This class is not thread safe.
+class OutputSink final
+{
+private:
+
+    static constexpr size_t bufferSize = 64 * 1024;
+
+    std::FILE* m_file = nullptr;
+    std::vector<char> m_buffer;
+    size_t m_used = 0;
+    const int m_flushCaptions;
+    const std::chrono::milliseconds m_flushInterval;
+    const bool m_durable;
+    int m_captionsSinceFlush = 0;
+    std::chrono::steady_clock::time_point m_lastFlush;
+
+    void WriteBuffer()
+    {
+        if (m_used > 0)
+        {
+            if (std::fwrite(m_buffer.data(), 1, m_used, m_file) != m_used)
+            {
+                throw std::runtime_error("Failed to write to the output file.");
+            }
+            m_used = 0;
+        }
+    }
+
+    void Sync()
+    {
+#if defined(_MSC_VER)
+        auto result = _commit(_fileno(m_file));
+#elif defined(__APPLE__)
+        auto result = fsync(fileno(m_file));
+#else
+        auto result = fdatasync(fileno(m_file));
+#endif
+        if (0 != result)
+        {
+            throw std::runtime_error("Failed to sync the output file to the storage device.");
+        }
+    }
+
+public:
+
+    // Opens and truncates the output file.
+    // flushCaptions: Flush after this many captions. 1 flushes after every caption.
+    // flushInterval: Flush pending captions this long after the last flush. 0 disables the interval.
+    // durable: Sync the file to the storage device after each flush.
+    // binary: Write bytes as is, without newline translation.
+    OutputSink(const std::string& fileName, int flushCaptions, int flushIntervalMilliseconds, bool durable, bool binary = false)
+        : m_buffer(bufferSize), m_flushCaptions(flushCaptions), m_flushInterval(flushIntervalMilliseconds), m_durable(durable), m_lastFlush(std::chrono::steady_clock::now())
+    {
+#if defined(_MSC_VER)
+        if (0 != fopen_s(&m_file, fileName.c_str(), binary ? "wb" : "w"))
+        {
+            m_file = nullptr;
+        }
+#else
+        m_file = std::fopen(fileName.c_str(), binary ? "wb" : "w");
+#endif
+        if (nullptr == m_file)
+        {
+            throw std::invalid_argument("Failed to open the output file: " + fileName);
+        }
+        // We do our own buffering.
+        std::setvbuf(m_file, nullptr, _IONBF, 0);
+    }
+
+    ~OutputSink()
+    {
+        try
+        {
+            Flush();
+        }
+        catch (...)
+        {
+        }
+        std::fclose(m_file);
+    }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    // Appends a caption, or other text, to the buffer, and flushes if a flush condition is met.
+    void Write(std::string_view text)
+    {
+        if (m_used + text.length() > m_buffer.size())
+        {
+            WriteBuffer();
+        }
+        if (text.length() > m_buffer.size())
+        {
+            // Too large to buffer, so write it directly.
+            if (std::fwrite(text.data(), 1, text.length(), m_file) != text.length())
+            {
+                throw std::runtime_error("Failed to write to the output file.");
+            }
+        }
+        else
+        {
+            std::copy(text.begin(), text.end(), m_buffer.begin() + m_used);
+            m_used += text.length();
+        }
+
+        m_captionsSinceFlush++;
+        if (m_captionsSinceFlush >= m_flushCaptions
+            || (m_flushInterval.count() > 0 && std::chrono::steady_clock::now() - m_lastFlush >= m_flushInterval))
+        {
+            Flush();
+        }
+    }
+
+    // Flushes if there are captions pending and the flush interval has passed since the last flush.
+    void FlushIfDue()
+    {
+        if (m_captionsSinceFlush > 0 && m_flushInterval.count() > 0 && std::chrono::steady_clock::now() - m_lastFlush >= m_flushInterval)
+        {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        WriteBuffer();
+        if (m_durable)
+        {
+            Sync();
+        }
+        m_captionsSinceFlush = 0;
+        m_lastFlush = std::chrono::steady_clock::now();
+    }
+};
@@ -0,0 +1,189 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <speechapi_cxx.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "audio_pacer.h"
+#include "audio_ring_buffer.h"
+#include "audio_source.h"
+#include "resampler.h"
+
+using namespace Microsoft::CognitiveServices::Speech::Audio;
+
+// Feeds raw PCM from an AudioSource, such as standard input or a UNIX domain socket, to a PushAudioInputStream.
+// A reader thread takes audio from the source as soon as it arrives, so the encoder that writes it is
+// never held up by recognition, and puts it in an AudioRingBuffer. A pusher thread takes the audio out
+// in chunks of a fixed duration and writes them to the stream. Smaller chunks lower the latency
+// of recognition and cost more calls to PushAudioInputStream::Write().
+// If the ring buffer is full, the audio that does not fit is dropped, and this counts as an overrun.
+// If the pusher runs out of audio before the input ends, this counts as an underrun.
+// With an AudioPacer, the reader thread takes audio from the source no faster than it would arrive live,
+// so a file redirected to standard input is pushed as if it came from a microphone.
+class PcmStreamInput final
+{
+private:
+
+    const std::shared_ptr<AudioSource> m_source;
+    // If set, paces the reads from m_source.
+    const std::shared_ptr<AudioPacer> m_pacer;
+    const std::shared_ptr<PushAudioInputStream> m_stream;
+    const size_t m_blockAlign;
+    const size_t m_chunkBytes;
+    const std::chrono::microseconds m_chunkDuration;
+    AudioRingBuffer m_ring;
+    // If set, each chunk is resampled into m_resampled before it is written to the stream.
+    std::unique_ptr<Resampler> m_resampler;
+    std::vector<uint8_t> m_resampled;
+
+    std::atomic<bool> m_ended = false;
+    std::atomic<bool> m_stopping = false;
+    std::atomic<uint64_t> m_overruns = 0;
+    std::atomic<uint64_t> m_droppedBytes = 0;
+    std::atomic<uint64_t> m_underruns = 0;
+
+    std::thread m_reader;
+    std::thread m_pusher;
+
+    void Read()
+    {
+        // Only whole sample frames go into the ring buffer, so dropping audio never splits a frame.
+        // The bytes of a partial frame wait at the start of buffer for the rest of the frame.
+        std::vector<uint8_t> buffer(m_chunkBytes + m_blockAlign);
+        size_t pending = 0;
+        int length = 0;
+        while ((length = m_source->Read(buffer.data() + pending, (uint32_t)m_chunkBytes)) > 0)
+        {
+            if (m_pacer && !m_pacer->Release(length))
+            {
+                break;
+            }
+            auto total = pending + length;
+            auto frames = total - total % m_blockAlign;
+            if (frames > 0 && !m_ring.TryWrite(buffer.data(), frames))
+            {
+                m_overruns.fetch_add(1, std::memory_order_relaxed);
+                m_droppedBytes.fetch_add(frames, std::memory_order_relaxed);
+            }
+            pending = total - frames;
+            std::memmove(buffer.data(), buffer.data() + frames, pending);
+        }
+        m_ended.store(true, std::memory_order_release);
+    }
+
+    void Push()
+    {
+        std::vector<uint8_t> chunk(m_chunkBytes);
+        bool started = false;
+        bool stalled = false;
+        while (!m_stopping.load())
+        {
+            // Check for the end first. Once it is set, the size includes all of the input.
+            auto ended = m_ended.load(std::memory_order_acquire);
+            auto available = m_ring.Size();
+            if (available >= m_chunkBytes || (ended && available > 0))
+            {
+                auto length = m_ring.Read(chunk.data(), m_chunkBytes);
+                if (m_resampler)
+                {
+                    // The ring buffer holds whole frames, so a chunk does too.
+                    length = m_resampler->Process(chunk.data(), length / m_blockAlign, m_resampled.data()) * m_blockAlign;
+                }
+                if (length > 0)
+                {
+                    m_stream->Write(m_resampler ? m_resampled.data() : chunk.data(), (uint32_t)length);
+                }
+                started = true;
+                stalled = false;
+            }
+            else if (ended)
+            {
+                if (m_resampler)
+                {
+                    // The last of the input is still in the filter.
+                    auto length = m_resampler->Flush(m_resampled.data()) * m_blockAlign;
+                    if (length > 0)
+                    {
+                        m_stream->Write(m_resampled.data(), (uint32_t)length);
+                    }
+                }
+                break;
+            }
+            else
+            {
+                // Count each stall once, and not the wait for the first audio.
+                if (started && !stalled)
+                {
+                    m_underruns.fetch_add(1, std::memory_order_relaxed);
+                    stalled = true;
+                }
+                std::this_thread::sleep_for(m_chunkDuration / 4);
+            }
+        }
+        // Closing the stream ends recognition once the audio written so far is recognized.
+        m_stream->Close();
+    }
+
+public:
+
+    // Reads from source until it ends. The audio is PCM with blockAlign bytes per sample frame and
+    // bytesPerSecond bytes per second. The ring buffer holds bufferMilliseconds of audio. The audio is 16-bit,
+    // and if outputSampleRate is not its sample rate, it is resampled to outputSampleRate before it is written to stream.
+    // If pacer is not null, it paces the input.
+    PcmStreamInput(std::shared_ptr<AudioSource> source, std::shared_ptr<PushAudioInputStream> stream, size_t bytesPerSecond, size_t blockAlign, int chunkMilliseconds, int bufferMilliseconds, int outputSampleRate, std::shared_ptr<AudioPacer> pacer)
+        : m_source(source),
+        m_pacer(pacer),
+        m_stream(stream),
+        m_blockAlign(blockAlign),
+        m_chunkBytes(AudioChunkBytes(bytesPerSecond, blockAlign, chunkMilliseconds)),
+        m_chunkDuration(std::chrono::milliseconds(chunkMilliseconds)),
+        m_ring(std::max(m_chunkBytes * 2, AudioChunkBytes(bytesPerSecond, blockAlign, bufferMilliseconds)))
+    {
+        auto sampleRate = (int)(bytesPerSecond / blockAlign);
+        if (outputSampleRate != sampleRate)
+        {
+            m_resampler = std::make_unique<Resampler>(sampleRate, outputSampleRate, (int)(blockAlign / sizeof(int16_t)));
+            m_resampled.resize(m_resampler->GetMaxOutputFrames(std::max(m_chunkBytes / blockAlign, m_resampler->GetDelayFrames())) * blockAlign);
+        }
+        m_reader = std::thread([this] { Read(); });
+        m_pusher = std::thread([this] { Push(); });
+    }
+
+    // Stops reading, even if the input has not ended.
+    ~PcmStreamInput()
+    {
+        m_stopping = true;
+        m_source->Stop();
+        if (m_pacer)
+        {
+            m_pacer->Stop();
+        }
+        m_reader.join();
+        m_pusher.join();
+    }
+
+    PcmStreamInput(const PcmStreamInput&) = delete;
+    PcmStreamInput& operator=(const PcmStreamInput&) = delete;
+
+    std::string Report() const
+    {
+        char report[256];
+        snprintf(report, sizeof(report), "Audio input: %s, %llu overruns (%llu bytes dropped), %llu underruns.\n",
+            m_source->GetCounters().ToString().c_str(),
+            (unsigned long long)m_overruns.load(),
+            (unsigned long long)m_droppedBytes.load(),
+            (unsigned long long)m_underruns.load());
+        return report;
+    }
+};
@@ -0,0 +1,317 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "caption_helper.h"
+#include "output_sink.h"
+
+// Number of calls to the global operator new. When CAPTIONING_COUNT_ALLOCATIONS is defined, captioning.cpp
+// replaces operator new to count them, so replay can report allocations per caption. It is off by default,
+// because every allocation in the program then updates this one counter.
+inline std::atomic<uint64_t> allocationCount{ 0 };
+
+// A fixture file has one JSON object per line, one line per recognition event, in the order they were received:
+// { "reason": "Recognizing", "text": "hello", "offset": 1000000, "duration": 5000000 }
+// "reason" is Recognizing or Recognized. "offset" and "duration" are in 100-nanosecond ticks.
+// "json" is optional, and holds the detailed result used for word timings.
+inline std::vector<RecognitionEvent> EventsFromFixture(const std::string& fileName)
+{
+    std::ifstream stream(fileName);
+    if (!stream.good())
+    {
+        throw std::invalid_argument("Failed to open the fixture file: " + fileName);
+    }
+
+    std::vector<RecognitionEvent> retval;
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (StringHelper::TrimView(line).empty())
+        {
+            continue;
+        }
+        auto event = nlohmann::json::parse(line, nullptr, false);
+        if (event.is_discarded() || !event.is_object() || !event.contains("text") || !event.contains("offset"))
+        {
+            throw std::invalid_argument("Each line in the fixture file must be a JSON object with \"text\" and \"offset\": " + line);
+        }
+        retval.emplace_back(
+            event.value("text", ""),
+            Ticks(event.value("offset", (uint64_t)0)),
+            Ticks(event.value("duration", (uint64_t)0)),
+            "Recognized" == event.value("reason", ""),
+            event.value("json", ""));
+    }
+    return retval;
+}
+
+// Writes recognition events to a fixture file that EventsFromFixture() can read.
+// This class is not thread safe.
+class FixtureWriter final
+{
+private:
+
+    OutputSink m_sink;
+
+public:
+
+    // The file is written when the buffer fills and when the writer is destroyed.
+    FixtureWriter(const std::string& fileName) : m_sink(fileName, INT_MAX, 0, false, true)
+    {}
+
+    void Write(const RecognitionEvent& event)
+    {
+        nlohmann::json line = {
+            { "reason", event.isFinal ? "Recognized" : "Recognizing" },
+            { "text", event.text },
+            { "offset", event.offset.Value() },
+            { "duration", event.duration.Value() }
+        };
+        if (!event.json.empty())
+        {
+            line["json"] = event.json;
+        }
+        m_sink.Write(line.dump() + "\n");
+    }
+};
+
+// The timestamp formatter that FormatTimestamp() replaced, kept as the reference for the timestamp
+// measurement in Captioning::Replay(). It allocates a stream and a string for each timestamp.
+inline std::string ReferenceStringFromTimestamp(Timestamp ts, bool srt)
+{
+    std::ostringstream retval;
+    retval << std::setfill('0') << std::setw(2) << ts.Hours << ":"
+        << std::setfill('0') << std::setw(2) << ts.Minutes << ":"
+        << std::setfill('0') << std::setw(2) << ts.Seconds;
+    // SRT format requires ',' as decimal separator rather than '.'.
+    retval << (srt ? "," : ".");
+    retval << std::setfill('0') << std::setw(3) << ts.Milliseconds;
+    return retval.str();
+}
+
+// The line breaker that CaptionHelper::LinesFromText() replaced, kept as the reference for the line breaking
+// measurement in Captioning::Replay(). It copies the text for each call, and finds each break with substr()
+// and find_last_of(). It measures widths in bytes and knows none of the rules of BreakTable, so the two
+// break a text into the same lines only if Applies() to it.
+class ReferenceLineBreaker final
+{
+private:
+
+    std::vector<std::string> m_firstPassTerminators;
+    std::vector<std::string> m_secondPassTerminators;
+    int m_maxWidth;
+
+    int GetBestWidth(std::string text, int startIndex)
+    {
+        auto remaining = (int)text.length() - startIndex;
+        // FindBestWidth can return -1.
+        int bestWidth = remaining < m_maxWidth
+            ? remaining
+            : FindBestWidth(m_firstPassTerminators, text, startIndex);
+
+        if (bestWidth < 0)
+        {
+            bestWidth = FindBestWidth(m_secondPassTerminators, text, startIndex);
+        }
+
+        if (bestWidth < 0)
+        {
+            bestWidth = m_maxWidth;
+        }
+
+        return bestWidth;
+    }
+
+    int FindBestWidth(std::vector<std::string> terminators, std::string text, int startAt)
+    {
+        auto remaining = (int)text.length() - startAt;
+        auto checkChars = remaining < m_maxWidth ? remaining : m_maxWidth;
+
+        auto bestWidth = -1;
+        for (auto terminator : terminators)
+        {
+            // find_last_of() returns npos if the terminator is not found, which is -1 as an int.
+            int index = (int)text.substr(startAt, checkChars).find_last_of(terminator) + startAt;
+            int width = index - startAt;
+            if (width > bestWidth)
+            {
+                bestWidth = width + (int)terminator.length();
+            }
+        }
+
+        return bestWidth;
+    }
+
+    int SkipSkippable(std::string text, int startIndex)
+    {
+        auto index = startIndex;
+        while ((int)text.length() > index && text[index] == ' ')
+        {
+            index++;
+        }
+
+        return index;
+    }
+
+public:
+
+    // Chooses the terminators and default width for language as CaptionHelper does.
+    ReferenceLineBreaker(std::optional<std::string> language, int maxWidth) : m_maxWidth(maxWidth)
+    {
+        std::string iso639;
+        if (language.has_value())
+        {
+            iso639 = StringHelper::Split(language.value(), '-')[0];
+        }
+        auto isChineseOrJapanese = StringHelper::CaseInsensitiveCompare(iso639, "zh") || StringHelper::CaseInsensitiveCompare(iso639, "ja");
+        if (isChineseOrJapanese)
+        {
+            m_firstPassTerminators = {"，", "、", "；", "？", "！", "?", "!", ",", ";"};
+            m_secondPassTerminators = {"。", " "};
+        }
+        else
+        {
+            m_firstPassTerminators = {"?", "!", ",", ";"};
+            m_secondPassTerminators = {" ", "."};
+        }
+        if (maxWidth == UserConfig::defaultMaxLineLengthSBCS && (isChineseOrJapanese || StringHelper::CaseInsensitiveCompare(iso639, "ko")))
+        {
+            m_maxWidth = UserConfig::defaultMaxLineLengthMBCS;
+        }
+    }
+
+    std::vector<std::string> LinesFromText(std::string text)
+    {
+        std::vector<std::string> retval;
+
+        auto index = 0;
+        while (index < (int)text.length())
+        {
+            index = SkipSkippable(text, index);
+
+            int lineLength = GetBestWidth(text, index);
+            retval.push_back(StringHelper::Trim(text.substr(index, lineLength)));
+            index = index + lineLength;
+        }
+
+        return retval;
+    }
+
+    // Whether text has one byte per character, and none of the full stops before a letter or digit, commas
+    // between digits, or closing punctuation after a terminator that BreakTable treats differently.
+    static bool Applies(std::string_view text)
+    {
+        auto isTerminator = [](unsigned char c) { return c == '?' || c == '!' || c == ',' || c == ';' || c == '.'; };
+        auto isClose = [](unsigned char c) { return c == '"' || c == '\'' || c == ')' || c == ']' || c == '}'; };
+        for (size_t index = 0; index < text.length(); index++)
+        {
+            auto c = (unsigned char)text[index];
+            auto next = index + 1 < text.length() ? (unsigned char)text[index + 1] : 0;
+            auto previous = index > 0 ? (unsigned char)text[index - 1] : 0;
+            if (c >= 0x80
+                || ('.' == c && std::isalnum(next))
+                || (',' == c && std::isdigit(previous) && std::isdigit(next))
+                || (isTerminator(c) && isClose(next)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Measurements from replaying a fixture through the caption path.
+struct ReplayReport
+{
+    size_t events = 0;
+    size_t finalEvents = 0;
+    size_t captions = 0;
+    uint64_t allocations = 0;
+    std::chrono::nanoseconds elapsed{ 0 };
+    // Time spent on each event, in the order the events were replayed.
+    std::vector<std::chrono::nanoseconds> latencies;
+    // CaptionHelper::GetCaptions() over all final events at once.
+    size_t batchCaptions = 0;
+    std::chrono::nanoseconds batchElapsed{ 0 };
+    // CaptionHelper::LinesFromText() over the text of each final event, the line breaking part of GetCaptions().
+    size_t lines = 0;
+    std::chrono::nanoseconds linesElapsed{ 0 };
+    // ReferenceLineBreaker::LinesFromText() over the same text, and how many of the results it applies to
+    // were broken into different lines by the two.
+    size_t referenceLines = 0;
+    std::chrono::nanoseconds referenceLinesElapsed{ 0 };
+    size_t comparedLineResults = 0;
+    size_t differentLineResults = 0;
+    // FormatTimestamp() for the begin and end of each of the batchCaptions.
+    size_t timestamps = 0;
+    size_t timestampCharacters = 0;
+    std::chrono::nanoseconds timestampsElapsed{ 0 };
+    // ReferenceStringFromTimestamp() for the same timestamps, and how many timestamps, those and a sweep of
+    // other values in both formats, the two formatted differently.
+    size_t referenceTimestampCharacters = 0;
+    std::chrono::nanoseconds referenceTimestampsElapsed{ 0 };
+    size_t comparedTimestamps = 0;
+    size_t differentTimestamps = 0;
+
+    std::string ToString() const
+    {
+        auto sorted = latencies;
+        std::sort(sorted.begin(), sorted.end());
+        // Nearest-rank percentile, in microseconds.
+        auto percentile = [&sorted](double p)
+        {
+            if (sorted.empty())
+            {
+                return 0.0;
+            }
+            auto rank = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+            return sorted[rank].count() / 1000.0;
+        };
+        auto seconds = elapsed.count() / 1e9;
+        auto perSecond = [seconds](size_t count) { return seconds > 0 ? count / seconds : 0.0; };
+        auto nanosecondsEach = [](std::chrono::nanoseconds elapsed, size_t count) { return count > 0 ? (double)elapsed.count() / count : 0.0; };
+
+        std::ostringstream retval;
+        retval.setf(std::ios::fixed);
+        retval.precision(2);
+        retval << "Replayed " << events << " events (" << finalEvents << " recognized) in " << elapsed.count() / 1e6 << " ms: "
+            << perSecond(events) << " events/s, " << perSecond(captions) << " captions/s.\n"
+            << "Latency per event (microseconds): p50 " << percentile(50) << ", p90 " << percentile(90)
+            << ", p99 " << percentile(99) << ", max " << percentile(100) << ".\n";
+#if defined(CAPTIONING_COUNT_ALLOCATIONS)
+        retval << "Allocations per caption: " << (captions > 0 ? (double)allocations / captions : 0.0) << ".\n";
+#endif
+        retval << "CaptionHelper::GetCaptions: " << batchCaptions << " captions from " << finalEvents << " results in "
+            << batchElapsed.count() / 1e6 << " ms.\n"
+            << "Line breaking: " << lines << " lines in " << linesElapsed.count() / 1e6 << " ms, "
+            << nanosecondsEach(linesElapsed, lines) << " ns per line.\n"
+            << "Reference line breaking (substr and find_last_of): " << referenceLines << " lines in " << referenceLinesElapsed.count() / 1e6 << " ms, "
+            << nanosecondsEach(referenceLinesElapsed, referenceLines) << " ns per line. "
+            << (0 == differentLineResults ? "Same lines" : "DIFFERENT lines") << " for " << comparedLineResults - differentLineResults << " of "
+            << comparedLineResults << " comparable results.\n"
+            << "Timestamp formatting: " << timestamps << " timestamps (" << timestampCharacters << " characters) in " << timestampsElapsed.count() / 1e6 << " ms, "
+            << nanosecondsEach(timestampsElapsed, timestamps) << " ns per timestamp.\n"
+            << "Reference timestamp formatting (ostringstream): " << timestamps << " timestamps (" << referenceTimestampCharacters << " characters) in " << referenceTimestampsElapsed.count() / 1e6 << " ms, "
+            << nanosecondsEach(referenceTimestampsElapsed, timestamps) << " ns per timestamp. "
+            << (0 == differentTimestamps ? "Same text" : "DIFFERENT text") << " for " << comparedTimestamps - differentTimestamps << " of "
+            << comparedTimestamps << " timestamps compared.\n";
+        return retval.str();
+    }
+};
@@ -0,0 +1,333 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <speechapi_cxx.h>
+#include <stdexcept>
+#include <vector>
+#include "audio_source.h"
+#include "sample_conversion.h"
+
+using namespace Microsoft::CognitiveServices::Speech::Audio;
+
+// Changes the sample rate of interleaved 16-bit PCM, such as 44.1 or 48 kHz audio to the 16 kHz the
+// recognizer works best with, as the audio streams through.
+// This is a polyphase FIR filter. For a rate change of L/M in lowest terms, the audio is in effect
+// upsampled by L, low-pass filtered, and downsampled by M, but only the filter taps that land on
+// input samples are computed. The taps for each of the L phases are worked out once, when the
+// resampler is created, from a Kaiser-windowed sinc with about 80 dB of stopband attenuation.
+// All buffers are allocated when the resampler is created, so Process() does not allocate.
+// The filter is centered on each output, so the output is not delayed, but each output needs half the filter,
+// GetDelayFrames() input frames, of input after it. Flush() gives the last outputs when the input ends.
+class Resampler final
+{
+private:
+
+    // Filter taps per phase when the rate does not go down. Lowering the rate by a factor needs that many
+    // times more, so the filter can cut off below the lower Nyquist frequency.
+    static constexpr size_t baseTaps = 32;
+    // The passband ends at this fraction of the lower Nyquist frequency.
+    static constexpr double passband = 0.9;
+    static constexpr double kaiserBeta = 8.0;
+    static constexpr double pi = 3.14159265358979323846;
+    // Input frames that are filtered at a time.
+    static constexpr size_t blockFrames = 1024;
+
+    const size_t m_channels;
+    size_t m_up = 1;
+    size_t m_down = 1;
+    size_t m_taps = 0;
+    // The taps of each phase, in reverse order, so each output is a dot product with the input in order.
+    std::vector<float> m_phases;
+    // The input of each channel, one after another, each with room for the taps of history and a block.
+    std::vector<float> m_buffer;
+    size_t m_capacity = 0;
+    size_t m_buffered = 0;
+    // Position of the next output in the buffer, in 1/L of an input frame.
+    uint64_t m_position = 0;
+    // Frames of silence before the first input, so the filter is centered on the first output.
+    size_t m_history = 0;
+
+    // Modified Bessel function of the first kind, of order 0, for the Kaiser window.
+    static double BesselI0(double x)
+    {
+        double sum = 1;
+        double term = 1;
+        for (int k = 1; k < 50 && term > sum * 1e-12; k++)
+        {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    static float DotProduct(const float* a, const float* b, size_t count)
+    {
+        size_t i = 0;
+        float retval = 0;
+#if defined(SAMPLE_CONVERSION_AVX2)
+        auto sum8 = _mm256_setzero_ps();
+        for (; i + 8 <= count; i += 8)
+        {
+            sum8 = _mm256_add_ps(sum8, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        }
+        auto sum4 = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+#elif defined(SAMPLE_CONVERSION_SSE2)
+        auto sum4 = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+        {
+            sum4 = _mm_add_ps(sum4, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+#endif
+#if defined(SAMPLE_CONVERSION_SSE2)
+        // Add the 4 lanes together.
+        sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+        sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, 1));
+        retval = _mm_cvtss_f32(sum4);
+#elif defined(SAMPLE_CONVERSION_NEON)
+        auto sum4 = vdupq_n_f32(0);
+        for (; i + 4 <= count; i += 4)
+        {
+            sum4 = vfmaq_f32(sum4, vld1q_f32(a + i), vld1q_f32(b + i));
+        }
+        retval = vaddvq_f32(sum4);
+#endif
+        for (; i < count; i++)
+        {
+            retval += a[i] * b[i];
+        }
+        return retval;
+    }
+
+    void DesignFilter()
+    {
+        // The filter runs at L times the input rate, and cuts off below the Nyquist frequency of the lower rate.
+        auto cutoff = passband * 0.5 / std::max(m_up, m_down);
+        auto length = m_up * m_taps;
+        auto middle = (length - 1) / 2.0;
+        std::vector<double> prototype(length);
+        double sum = 0;
+        for (size_t n = 0; n < length; n++)
+        {
+            auto t = n - middle;
+            auto sinc = 0 == t ? 2 * cutoff : std::sin(2 * pi * cutoff * t) / (pi * t);
+            auto ratio = 2 * t / (length - 1);
+            auto window = BesselI0(kaiserBeta * std::sqrt(std::max(0.0, 1 - ratio * ratio))) / BesselI0(kaiserBeta);
+            prototype[n] = sinc * window;
+            sum += prototype[n];
+        }
+
+        // Each phase sees one tap in L, so a gain of L keeps the level of the input.
+        m_phases.resize(length);
+        for (size_t phase = 0; phase < m_up; phase++)
+        {
+            for (size_t tap = 0; tap < m_taps; tap++)
+            {
+                m_phases[phase * m_taps + m_taps - 1 - tap] = (float)(prototype[phase + tap * m_up] * m_up / sum);
+            }
+        }
+    }
+
+    // Implements Process() and Flush(). If input is null, the input is inputFrames frames of silence.
+    size_t Filter(const uint8_t* input, size_t inputFrames, uint8_t* output)
+    {
+        size_t outputFrames = 0;
+        while (inputFrames > 0)
+        {
+            auto frames = std::min(inputFrames, m_capacity - m_buffered);
+            if (nullptr == input)
+            {
+                for (size_t channel = 0; channel < m_channels; channel++)
+                {
+                    auto buffer = m_buffer.data() + channel * m_capacity + m_buffered;
+                    std::fill(buffer, buffer + frames, 0.0f);
+                }
+            }
+            else if (1 == m_channels)
+            {
+                ConvertInt16ToFloat32(input, (uint8_t*)(m_buffer.data() + m_buffered), frames);
+            }
+            else
+            {
+                for (size_t channel = 0; channel < m_channels; channel++)
+                {
+                    auto buffer = m_buffer.data() + channel * m_capacity + m_buffered;
+                    for (size_t frame = 0; frame < frames; frame++)
+                    {
+                        buffer[frame] = LoadInt16(input, frame * m_channels + channel) / 32768.0f;
+                    }
+                }
+            }
+            if (nullptr != input)
+            {
+                input += frames * m_channels * sizeof(int16_t);
+            }
+            inputFrames -= frames;
+            m_buffered += frames;
+
+            // Each output needs the taps of input that end at its position.
+            for (auto first = m_position / m_up; first + m_taps <= m_buffered; first = m_position / m_up)
+            {
+                auto taps = m_phases.data() + (m_position % m_up) * m_taps;
+                for (size_t channel = 0; channel < m_channels; channel++)
+                {
+                    auto sample = DotProduct(taps, m_buffer.data() + channel * m_capacity + first, m_taps);
+                    StoreInt16(output, outputFrames * m_channels + channel, FloatToInt16(sample));
+                }
+                outputFrames++;
+                m_position += m_down;
+            }
+
+            // Keep only the input that later outputs need. When the rate goes down a lot, the next output
+            // can start past the end of the input so far.
+            auto used = std::min<uint64_t>(m_position / m_up, m_buffered);
+            for (size_t channel = 0; channel < m_channels; channel++)
+            {
+                auto buffer = m_buffer.data() + channel * m_capacity;
+                std::memmove(buffer, buffer + used, (size_t)(m_buffered - used) * sizeof(float));
+            }
+            m_buffered -= (size_t)used;
+            m_position -= used * m_up;
+        }
+        return outputFrames;
+    }
+
+public:
+
+    Resampler(int inputRate, int outputRate, int channels) : m_channels((size_t)channels)
+    {
+        if (inputRate <= 0 || outputRate <= 0 || channels <= 0)
+        {
+            throw std::invalid_argument("The sample rates and channels of the resampler must be positive.");
+        }
+        auto divisor = std::gcd(inputRate, outputRate);
+        m_up = (size_t)(outputRate / divisor);
+        m_down = (size_t)(inputRate / divisor);
+        // Rounded up to a multiple of 8, for the vector loops.
+        m_taps = (baseTaps * std::max<size_t>(1, (m_down + m_up - 1) / m_up) + 7) / 8 * 8;
+        DesignFilter();
+
+        m_capacity = m_taps - 1 + blockFrames;
+        m_buffer.resize(m_channels * m_capacity);
+        m_history = m_taps - 1 - GetDelayFrames();
+        m_buffered = m_history;
+    }
+
+    Resampler(const Resampler&) = delete;
+    Resampler& operator=(const Resampler&) = delete;
+
+    // The most frames Process() can return for inputFrames input frames.
+    size_t GetMaxOutputFrames(size_t inputFrames) const
+    {
+        return (size_t)((uint64_t)inputFrames * m_up / m_down + 2);
+    }
+
+    // Input frames each output needs after it.
+    size_t GetDelayFrames() const
+    {
+        return m_taps / 2;
+    }
+
+    // Resamples inputFrames frames from input into output, which must have room for GetMaxOutputFrames(inputFrames).
+    // Returns the number of frames written to output. Input that does not make a whole output frame yet is
+    // kept for the next call.
+    size_t Process(const uint8_t* input, size_t inputFrames, uint8_t* output)
+    {
+        return Filter(input, inputFrames, output);
+    }
+
+    // Writes the outputs that are still waiting for input after them, as if the input were followed by silence,
+    // into output, which must have room for GetMaxOutputFrames(GetDelayFrames()). Returns the number of frames
+    // written. All the input then has its outputs, so for N input frames there are N * L / M outputs, rounded up.
+    // The resampler then starts again, as if it had just been created.
+    size_t Flush(uint8_t* output)
+    {
+        auto outputFrames = Filter(nullptr, GetDelayFrames(), output);
+        std::fill(m_buffer.begin(), m_buffer.end(), 0.0f);
+        m_buffered = m_history;
+        m_position = 0;
+        return outputFrames;
+    }
+};
+
+// Wraps an AudioSource of 16-bit PCM to resample what it reads. See Resampler.
+// Its counters include the time spent resampling; those of the source it wraps measure the input alone.
+class ResamplingReader final : public AudioSource
+{
+private:
+
+    // Input frames read from the source at a time.
+    static constexpr size_t readFrames = 1024;
+
+    const std::shared_ptr<AudioSource> m_source;
+    const size_t m_blockAlign;
+    Resampler m_resampler;
+    std::vector<uint8_t> m_input;
+    // Bytes of a partial frame at the start of m_input, from the end of the last read.
+    size_t m_pending = 0;
+    // Resampled audio that has not been returned by Read() yet.
+    std::vector<uint8_t> m_output;
+    size_t m_outputStart = 0;
+    size_t m_outputEnd = 0;
+    bool m_flushed = false;
+
+protected:
+
+    // Implements AudioSource::ReadSource(). Returns 0 when the source ends, after the last of the resampled audio.
+    int ReadSource(uint8_t* dataBuffer, uint32_t size) override
+    {
+        while (m_outputStart == m_outputEnd)
+        {
+            if (m_flushed)
+            {
+                return 0;
+            }
+            auto length = m_source->Read(m_input.data() + m_pending, (uint32_t)(m_input.size() - m_pending));
+            if (length <= 0)
+            {
+                m_outputStart = 0;
+                m_outputEnd = m_resampler.Flush(m_output.data()) * m_blockAlign;
+                m_flushed = true;
+                continue;
+            }
+            auto total = m_pending + length;
+            auto frames = total / m_blockAlign;
+            m_outputStart = 0;
+            m_outputEnd = m_resampler.Process(m_input.data(), frames, m_output.data()) * m_blockAlign;
+            m_pending = total - frames * m_blockAlign;
+            std::memmove(m_input.data(), m_input.data() + frames * m_blockAlign, m_pending);
+        }
+        auto length = std::min<size_t>(size, m_outputEnd - m_outputStart);
+        std::memcpy(dataBuffer, m_output.data() + m_outputStart, length);
+        m_outputStart += length;
+        return (int)length;
+    }
+
+    void CloseSource() override
+    {
+        m_source->Close();
+    }
+
+public:
+
+    ResamplingReader(std::shared_ptr<AudioSource> source, int inputRate, int outputRate, int channels)
+        : m_source(source),
+        m_blockAlign(channels * sizeof(int16_t)),
+        m_resampler(inputRate, outputRate, channels),
+        m_input(readFrames * m_blockAlign),
+        m_output(m_resampler.GetMaxOutputFrames(std::max(readFrames, m_resampler.GetDelayFrames())) * m_blockAlign)
+    {}
+
+    void Stop() override
+    {
+        m_source->Stop();
+    }
+};
@@ -0,0 +1,362 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+// The vector paths are chosen when the sample is compiled, from the instruction sets the compiler may use.
+// SSE2 is always available on x64. AVX2 needs /arch:AVX2 or -mavx2. NEON is always available on ARM64.
+#if defined(__AVX2__)
+#define SAMPLE_CONVERSION_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAMPLE_CONVERSION_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(SAMPLE_CONVERSION_AVX2)
+#define SAMPLE_CONVERSION_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(SAMPLE_CONVERSION_AVX2)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define SAMPLE_CONVERSION_NEON
+#include <arm_neon.h>
+#endif
+
+// Conversions between sample formats and channel layouts of uncompressed audio.
+// Buffers are bytes, as the Speech SDK passes them, and need not be aligned for their samples.
+// Each function has a vector path for the instruction sets above and a scalar path for the rest of
+// the samples and for other machines, and both give the same results.
+// This assumes a little-endian machine, which all targets of the Speech SDK are.
+
+// How each sample of an uncompressed audio stream is stored. All formats are little-endian.
+enum class SampleFormat
+{
+    Unsupported,
+    // 8-bit PCM, which is unsigned, with silence at 128.
+    UInt8,
+    Int16,
+    // Packed in 3 bytes.
+    Int24,
+    Int32,
+    // IEEE floating point, with full scale at -1.0 and 1.0.
+    Float32,
+    Float64
+};
+
+inline size_t BytesPerSample(SampleFormat format)
+{
+    switch (format)
+    {
+    case SampleFormat::UInt8: return 1;
+    case SampleFormat::Int16: return 2;
+    case SampleFormat::Int24: return 3;
+    case SampleFormat::Int32: return 4;
+    case SampleFormat::Float32: return 4;
+    case SampleFormat::Float64: return 8;
+    default: return 0;
+    }
+}
+
+inline int16_t LoadInt16(const uint8_t* source, size_t index)
+{
+    int16_t retval;
+    memcpy(&retval, source + index * sizeof(int16_t), sizeof(int16_t));
+    return retval;
+}
+
+inline void StoreInt16(uint8_t* target, size_t index, int32_t sample)
+{
+    auto value = (int16_t)sample;
+    memcpy(target + index * sizeof(int16_t), &value, sizeof(int16_t));
+}
+
+// Scales a floating point sample to 16 bits, clips it, and rounds it to the nearest integer, with halves
+// away from zero. NaN becomes silence. Rounding goes by the exact fraction, so float and double agree.
+template <typename Float>
+inline int32_t FloatToInt16(Float sample)
+{
+    // NaN is not equal to itself.
+    sample = sample == sample ? sample * (Float)32768 : (Float)0;
+    sample = sample < (Float)32767 ? sample : (Float)32767;
+    sample = sample > (Float)-32768 ? sample : (Float)-32768;
+    auto truncated = (int32_t)sample;
+    auto fraction = sample - (Float)truncated;
+    return truncated + (fraction >= (Float)0.5 ? 1 : 0) - (fraction <= (Float)-0.5 ? 1 : 0);
+}
+
+// Division that rounds down, as an arithmetic shift does, rather than toward zero.
+inline int32_t FloorDivide(int32_t value, int32_t divisor)
+{
+    return (value - (value < 0 ? divisor - 1 : 0)) / divisor;
+}
+
+#if defined(SAMPLE_CONVERSION_SSE2)
+// The same steps as FloatToInt16(), on 4 samples.
+inline __m128i FloatToInt16Sse2(__m128 sample)
+{
+    sample = _mm_and_ps(sample, _mm_cmpeq_ps(sample, sample));
+    sample = _mm_mul_ps(sample, _mm_set1_ps(32768.0f));
+    sample = _mm_min_ps(sample, _mm_set1_ps(32767.0f));
+    sample = _mm_max_ps(sample, _mm_set1_ps(-32768.0f));
+    auto truncated = _mm_cvttps_epi32(sample);
+    auto fraction = _mm_sub_ps(sample, _mm_cvtepi32_ps(truncated));
+    // Comparisons give -1 where they are true.
+    truncated = _mm_sub_epi32(truncated, _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f))));
+    return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmple_ps(fraction, _mm_set1_ps(-0.5f))));
+}
+#endif
+
+#if defined(SAMPLE_CONVERSION_AVX2)
+// The same steps as FloatToInt16(), on 8 samples.
+inline __m256i FloatToInt16Avx2(__m256 sample)
+{
+    sample = _mm256_and_ps(sample, _mm256_cmp_ps(sample, sample, _CMP_EQ_OQ));
+    sample = _mm256_mul_ps(sample, _mm256_set1_ps(32768.0f));
+    sample = _mm256_min_ps(sample, _mm256_set1_ps(32767.0f));
+    sample = _mm256_max_ps(sample, _mm256_set1_ps(-32768.0f));
+    auto truncated = _mm256_cvttps_epi32(sample);
+    auto fraction = _mm256_sub_ps(sample, _mm256_cvtepi32_ps(truncated));
+    truncated = _mm256_sub_epi32(truncated, _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ)));
+    return _mm256_add_epi32(truncated, _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(-0.5f), _CMP_LE_OQ)));
+}
+#endif
+
+// Converts count 32-bit floating point samples from source to 16-bit PCM in target.
+inline void ConvertFloat32ToInt16(const uint8_t* source, uint8_t* target, size_t count)
+{
+    size_t i = 0;
+#if defined(SAMPLE_CONVERSION_AVX2)
+    for (; i + 16 <= count; i += 16)
+    {
+        auto low = FloatToInt16Avx2(_mm256_loadu_ps((const float*)(source + i * sizeof(float))));
+        auto high = FloatToInt16Avx2(_mm256_loadu_ps((const float*)(source + (i + 8) * sizeof(float))));
+        // Packing works within each 128-bit half, so the 64-bit quarters come out as 0, 2, 1, 3.
+        auto packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+        _mm256_storeu_si256((__m256i*)(target + i * sizeof(int16_t)), packed);
+    }
+#endif
+#if defined(SAMPLE_CONVERSION_SSE2)
+    for (; i + 8 <= count; i += 8)
+    {
+        auto low = FloatToInt16Sse2(_mm_loadu_ps((const float*)(source + i * sizeof(float))));
+        auto high = FloatToInt16Sse2(_mm_loadu_ps((const float*)(source + (i + 4) * sizeof(float))));
+        _mm_storeu_si128((__m128i*)(target + i * sizeof(int16_t)), _mm_packs_epi32(low, high));
+    }
+#elif defined(SAMPLE_CONVERSION_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        // The conversion rounds halves away from zero and turns NaN into 0, as FloatToInt16() does.
+        auto scale = [](float32x4_t sample)
+        {
+            sample = vmulq_n_f32(sample, 32768.0f);
+            sample = vminq_f32(sample, vdupq_n_f32(32767.0f));
+            sample = vmaxq_f32(sample, vdupq_n_f32(-32768.0f));
+            return vcvtaq_s32_f32(sample);
+        };
+        auto low = scale(vld1q_f32((const float*)(source + i * sizeof(float))));
+        auto high = scale(vld1q_f32((const float*)(source + (i + 4) * sizeof(float))));
+        vst1q_s16((int16_t*)(target + i * sizeof(int16_t)), vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float sample;
+        memcpy(&sample, source + i * sizeof(float), sizeof(float));
+        StoreInt16(target, i, FloatToInt16(sample));
+    }
+}
+
+// Converts count 16-bit PCM samples from source to 32-bit floating point in target, with full scale at -1.0 and 1.0.
+inline void ConvertInt16ToFloat32(const uint8_t* source, uint8_t* target, size_t count)
+{
+    constexpr float scale = 1.0f / 32768.0f;
+    size_t i = 0;
+#if defined(SAMPLE_CONVERSION_AVX2)
+    for (; i + 8 <= count; i += 8)
+    {
+        auto samples = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(source + i * sizeof(int16_t))));
+        _mm256_storeu_ps((float*)(target + i * sizeof(float)), _mm256_mul_ps(_mm256_cvtepi32_ps(samples), _mm256_set1_ps(scale)));
+    }
+#endif
+#if defined(SAMPLE_CONVERSION_SSE2)
+    for (; i + 8 <= count; i += 8)
+    {
+        auto samples = _mm_loadu_si128((const __m128i*)(source + i * sizeof(int16_t)));
+        // Widen to 32 bits by putting each sample in the top half and shifting it back down with its sign.
+        auto low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+        auto high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+        _mm_storeu_ps((float*)(target + i * sizeof(float)), _mm_mul_ps(_mm_cvtepi32_ps(low), _mm_set1_ps(scale)));
+        _mm_storeu_ps((float*)(target + (i + 4) * sizeof(float)), _mm_mul_ps(_mm_cvtepi32_ps(high), _mm_set1_ps(scale)));
+    }
+#elif defined(SAMPLE_CONVERSION_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        auto samples = vld1q_s16((const int16_t*)(source + i * sizeof(int16_t)));
+        auto low = vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples)));
+        auto high = vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples)));
+        vst1q_f32((float*)(target + i * sizeof(float)), vmulq_n_f32(low, scale));
+        vst1q_f32((float*)(target + (i + 4) * sizeof(float)), vmulq_n_f32(high, scale));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        auto sample = LoadInt16(source, i) * scale;
+        memcpy(target + i * sizeof(float), &sample, sizeof(float));
+    }
+}
+
+// Converts count packed 24-bit PCM samples from source to 16-bit PCM in target, keeping the top 16 bits.
+inline void ConvertInt24ToInt16(const uint8_t* source, uint8_t* target, size_t count)
+{
+    size_t i = 0;
+#if defined(SAMPLE_CONVERSION_SSSE3)
+    // Picks the top two bytes of each of 4 samples into the low half. Each load reads 16 bytes for 12,
+    // so the loop stops while there are 4 bytes to spare.
+    const auto pick = _mm_setr_epi8(1, 2, 4, 5, 7, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (; (i + 8) * 3 + 4 <= count * 3; i += 8)
+    {
+        auto low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i * 3)), pick);
+        auto high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + (i + 4) * 3)), pick);
+        _mm_storeu_si128((__m128i*)(target + i * sizeof(int16_t)), _mm_unpacklo_epi64(low, high));
+    }
+#elif defined(SAMPLE_CONVERSION_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        // Splits 16 samples into their low, middle and high bytes.
+        auto bytes = vld3q_u8(source + i * 3);
+        vst1q_u8(target + i * sizeof(int16_t), vzip1q_u8(bytes.val[1], bytes.val[2]));
+        vst1q_u8(target + (i + 8) * sizeof(int16_t), vzip2q_u8(bytes.val[1], bytes.val[2]));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        auto bytes = source + i * 3;
+        StoreInt16(target, i, (int16_t)(bytes[1] | (bytes[2] << 8)));
+    }
+}
+
+// Converts count samples from source, in format, to 16-bit PCM in target. Integer samples keep their
+// top 16 bits, and floating point samples outside -1.0 to 1.0 are clipped.
+inline void ConvertToInt16(SampleFormat format, const uint8_t* source, uint8_t* target, size_t count)
+{
+    switch (format)
+    {
+    case SampleFormat::UInt8:
+        for (size_t i = 0; i < count; i++)
+        {
+            StoreInt16(target, i, ((int32_t)source[i] - 128) * 256);
+        }
+        break;
+    case SampleFormat::Int16:
+        memcpy(target, source, count * sizeof(int16_t));
+        break;
+    case SampleFormat::Int24:
+        ConvertInt24ToInt16(source, target, count);
+        break;
+    case SampleFormat::Int32:
+        for (size_t i = 0; i < count; i++)
+        {
+            int32_t sample;
+            memcpy(&sample, source + i * sizeof(int32_t), sizeof(int32_t));
+            StoreInt16(target, i, sample >> 16);
+        }
+        break;
+    case SampleFormat::Float32:
+        ConvertFloat32ToInt16(source, target, count);
+        break;
+    case SampleFormat::Float64:
+        for (size_t i = 0; i < count; i++)
+        {
+            double sample;
+            memcpy(&sample, source + i * sizeof(double), sizeof(double));
+            StoreInt16(target, i, FloatToInt16(sample));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Mixes frames of interleaved 16-bit PCM with channels channels from source into one channel in target.
+// Each sample is the mean of the channels, rounded down, so mixing never clips.
+inline void MixToMono(const uint8_t* source, uint8_t* target, size_t frames, size_t channels)
+{
+    size_t i = 0;
+    if (2 == channels)
+    {
+#if defined(SAMPLE_CONVERSION_AVX2)
+        for (; i + 16 <= frames; i += 16)
+        {
+            // Multiplying by 1 and adding neighbours sums the two channels of each frame into 32 bits.
+            const auto ones = _mm256_set1_epi16(1);
+            auto low = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(source + i * 4)), ones), 1);
+            auto high = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(source + (i + 8) * 4)), ones), 1);
+            auto packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+            _mm256_storeu_si256((__m256i*)(target + i * sizeof(int16_t)), packed);
+        }
+#endif
+#if defined(SAMPLE_CONVERSION_SSE2)
+        for (; i + 8 <= frames; i += 8)
+        {
+            const auto ones = _mm_set1_epi16(1);
+            auto low = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(source + i * 4)), ones), 1);
+            auto high = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(source + (i + 4) * 4)), ones), 1);
+            _mm_storeu_si128((__m128i*)(target + i * sizeof(int16_t)), _mm_packs_epi32(low, high));
+        }
+#elif defined(SAMPLE_CONVERSION_NEON)
+        for (; i + 8 <= frames; i += 8)
+        {
+            auto samples = vld2q_s16((const int16_t*)(source + i * 4));
+            vst1q_s16((int16_t*)(target + i * sizeof(int16_t)), vhaddq_s16(samples.val[0], samples.val[1]));
+        }
+#endif
+    }
+    for (; i < frames; i++)
+    {
+        int32_t sum = 0;
+        for (size_t channel = 0; channel < channels; channel++)
+        {
+            sum += LoadInt16(source, i * channels + channel);
+        }
+        StoreInt16(target, i, FloorDivide(sum, (int32_t)channels));
+    }
+}
+
+// Copies one channel, counting from 0, of frames of interleaved 16-bit PCM with channels channels
+// from source to target.
+inline void ExtractChannel(const uint8_t* source, uint8_t* target, size_t frames, size_t channels, size_t channel)
+{
+    size_t i = 0;
+    if (2 == channels)
+    {
+#if defined(SAMPLE_CONVERSION_SSE2)
+        for (; i + 8 <= frames; i += 8)
+        {
+            // Shift the wanted sample of each frame into the low half, with its sign, and pack.
+            auto pick = [channel](__m128i samples)
+            {
+                return _mm_srai_epi32(0 == channel ? _mm_slli_epi32(samples, 16) : samples, 16);
+            };
+            auto low = pick(_mm_loadu_si128((const __m128i*)(source + i * 4)));
+            auto high = pick(_mm_loadu_si128((const __m128i*)(source + (i + 4) * 4)));
+            _mm_storeu_si128((__m128i*)(target + i * sizeof(int16_t)), _mm_packs_epi32(low, high));
+        }
+#elif defined(SAMPLE_CONVERSION_NEON)
+        for (; i + 8 <= frames; i += 8)
+        {
+            auto samples = vld2q_s16((const int16_t*)(source + i * 4));
+            vst1q_s16((int16_t*)(target + i * sizeof(int16_t)), 0 == channel ? samples.val[0] : samples.val[1]);
+        }
+#endif
+    }
+    for (; i < frames; i++)
+    {
+        memcpy(target + i * sizeof(int16_t), source + (i * channels + channel) * sizeof(int16_t), sizeof(int16_t));
+    }
+}
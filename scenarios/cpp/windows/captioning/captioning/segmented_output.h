@@ -0,0 +1,236 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "caption_helper.h"
+#include "output_sink.h"
+
+// Writes captions as a series of WebVTT segment files of a fixed duration, for HLS streaming,
+// and keeps an m3u8 subtitle playlist of the most recent segments up to date.
+// Segment n covers [n * segmentDuration, (n + 1) * segmentDuration) from the start of the audio.
+// A caption that spans a segment boundary is written to every segment it overlaps.
+// Each file is written to a temporary file and then renamed, so players never read a partial file.
+// Only the current segment and the playlist window are kept in memory, and segments that have left
+// the playlist for as long as the playlist is are deleted, so memory and disk use do not grow with
+// the length of the stream.
+// Segments are ended as time passes, by AdvanceTo(), so a silence does not stop the playlist from
+// updating, and by captions that begin after them. A caption that arrives after its segment has been
+// written goes into the current segment, where players still show it until it ends.
+// Captions must be written in order of their begin times. This class is not thread safe.
+class SegmentedOutput final
+{
+private:
+
+    static constexpr const char* playlistName = "captions.m3u8";
+
+    const std::filesystem::path m_directory;
+    const Ticks m_segmentDuration;
+    const size_t m_playlistLength;
+    const bool m_durable;
+
+    // Index of the segment being collected, and the text of its cues.
+    uint64_t m_segment = 0;
+    std::string m_text;
+    // Captions written to the current segment that continue into the next one.
+    std::vector<Caption> m_continuing;
+    // Index of the first segment in the playlist. The playlist ends with the segment before m_segment.
+    uint64_t m_playlistFirst = 0;
+
+    Ticks SegmentEnd(uint64_t segment) const
+    {
+        return Ticks((segment + 1) * m_segmentDuration.Value());
+    }
+
+    static std::string SegmentName(uint64_t segment)
+    {
+        return "captions" + std::to_string(segment) + ".vtt";
+    }
+
+    void AppendCue(const Caption& caption)
+    {
+        const std::string_view separator = " --> ";
+        char begin[timestampBufferSize];
+        char end[timestampBufferSize];
+        auto beginLength = FormatTimestamp(TimestampFromTicks(caption.begin), false, begin);
+        auto endLength = FormatTimestamp(TimestampFromTicks(caption.end), false, end);
+        m_text.append(begin, beginLength).append(separator).append(end, endLength).append("\n");
+        m_text.append(caption.text).append("\n\n");
+    }
+
+    // Writes text to fileName in the output directory, through a temporary file that replaces it.
+    void WriteFile(const std::string& fileName, std::string_view text)
+    {
+        auto path = m_directory / fileName;
+        auto temporaryPath = m_directory / (fileName + ".tmp");
+        {
+            OutputSink sink(temporaryPath.string(), INT_MAX, 0, m_durable, true);
+            sink.Write(text);
+            sink.Flush();
+        }
+        if (m_durable)
+        {
+            ReplaceDurably(temporaryPath, path);
+            return;
+        }
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error)
+        {
+            throw std::runtime_error("Failed to replace " + path.string() + ": " + error.message());
+        }
+    }
+
+    // Renames from to to, and waits until the rename itself has reached the storage device, so it is not
+    // lost on a power failure after the file was synced.
+    void ReplaceDurably(const std::filesystem::path& from, const std::filesystem::path& to)
+    {
+#if defined(_WIN32)
+        if (!MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            throw std::runtime_error("Failed to replace " + to.string() + ": " + std::system_category().message((int)GetLastError()));
+        }
+#else
+        std::error_code error;
+        std::filesystem::rename(from, to, error);
+        if (error)
+        {
+            throw std::runtime_error("Failed to replace " + to.string() + ": " + error.message());
+        }
+        // The rename is an entry in the directory, so the directory is synced.
+        auto directory = open(m_directory.c_str(), O_RDONLY);
+        auto synced = directory >= 0 && 0 == fsync(directory);
+        if (directory >= 0)
+        {
+            close(directory);
+        }
+        if (!synced)
+        {
+            throw std::runtime_error("Failed to sync the segment directory " + m_directory.string() + " to the storage device.");
+        }
+#endif
+    }
+
+    void WritePlaylist(bool ended)
+    {
+        auto seconds = m_segmentDuration.Milliseconds() / 1000.0;
+        // EXT-X-TARGETDURATION is a whole number of seconds that no segment exceeds.
+        auto targetDuration = (m_segmentDuration.Milliseconds() + 999) / 1000;
+
+        std::string playlist = "#EXTM3U\n#EXT-X-VERSION:3\n";
+        playlist += "#EXT-X-TARGETDURATION:" + std::to_string(targetDuration) + "\n";
+        playlist += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(m_playlistFirst) + "\n";
+        char extinf[64];
+        snprintf(extinf, sizeof(extinf), "#EXTINF:%.3f,\n", seconds);
+        for (auto segment = m_playlistFirst; segment < m_segment; segment++)
+        {
+            playlist.append(extinf).append(SegmentName(segment)).append("\n");
+        }
+        if (ended)
+        {
+            playlist += "#EXT-X-ENDLIST\n";
+        }
+        WriteFile(playlistName, playlist);
+    }
+
+    // Writes the current segment, adds it to the playlist, and starts the next segment
+    // with the captions that continue into it.
+    void EndSegment()
+    {
+        WriteFile(SegmentName(m_segment), "WEBVTT\nX-TIMESTAMP-MAP=MPEGTS:0,LOCAL:00:00:00.000\n\n" + m_text);
+        m_segment++;
+        m_text.clear();
+
+        if (m_segment - m_playlistFirst > m_playlistLength)
+        {
+            m_playlistFirst++;
+            // Keep segments available for one playlist length after they leave the playlist,
+            // for players that loaded an older playlist.
+            if (m_playlistFirst > m_playlistLength)
+            {
+                std::error_code ignored;
+                std::filesystem::remove(m_directory / SegmentName(m_playlistFirst - m_playlistLength - 1), ignored);
+            }
+        }
+        WritePlaylist(false);
+
+        auto segmentEnd = SegmentEnd(m_segment - 1);
+        m_continuing.erase(std::remove_if(m_continuing.begin(), m_continuing.end(), [segmentEnd](const Caption& caption) { return caption.end <= segmentEnd; }), m_continuing.end());
+        for (const auto& caption : m_continuing)
+        {
+            AppendCue(caption);
+        }
+    }
+
+public:
+
+    // Creates directory if it does not exist.
+    // durable: Sync each file to the storage device before it replaces the previous version.
+    SegmentedOutput(const std::string& directory, int segmentDurationSeconds, int playlistLength, bool durable)
+        : m_directory(directory), m_segmentDuration(Ticks::FromMilliseconds((uint64_t)segmentDurationSeconds * 1000)), m_playlistLength(playlistLength), m_durable(durable)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(m_directory, error);
+        if (error)
+        {
+            throw std::invalid_argument("Failed to create the segment directory " + directory + ": " + error.message());
+        }
+    }
+
+    SegmentedOutput(const SegmentedOutput&) = delete;
+    SegmentedOutput& operator=(const SegmentedOutput&) = delete;
+
+    // Writes the segments that end by time, including any without captions, because the playlist
+    // must not have gaps. Call it as the stream advances, with a time no later caption begins before.
+    void AdvanceTo(Ticks time)
+    {
+        while (time >= SegmentEnd(m_segment))
+        {
+            EndSegment();
+        }
+    }
+
+    void Write(const Caption& caption)
+    {
+        AdvanceTo(caption.begin);
+        AppendCue(caption);
+        if (caption.end > SegmentEnd(m_segment))
+        {
+            m_continuing.push_back(caption);
+        }
+    }
+
+    // Writes the last segment and ends the playlist.
+    void Finish()
+    {
+        auto continuesPastSegment = [this](const Caption& caption) { return caption.end > SegmentEnd(m_segment); };
+        while (std::any_of(m_continuing.begin(), m_continuing.end(), continuesPastSegment))
+        {
+            EndSegment();
+        }
+        EndSegment();
+        WritePlaylist(true);
+    }
+};
@@ -0,0 +1,232 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "audio_source.h"
+
+// Audio from standard input, such as a pipe from an encoder, or from one client of a UNIX domain socket.
+// Reads wait for input, but check every pollTimeoutMilliseconds whether the source has been stopped.
+class StreamAudioSource final : public AudioSource
+{
+private:
+
+#if defined(_WIN32)
+    using SocketHandle = SOCKET;
+    static constexpr SocketHandle invalidSocket = INVALID_SOCKET;
+#else
+    using SocketHandle = int;
+    static constexpr SocketHandle invalidSocket = -1;
+#endif
+
+    // How long a read waits for input before it checks whether to stop.
+    static constexpr int pollTimeoutMilliseconds = 100;
+
+    // Empty to read from standard input.
+    const std::string m_socketPath;
+    SocketHandle m_listener = invalidSocket;
+    SocketHandle m_socket = invalidSocket;
+    std::atomic<bool> m_stopping = false;
+    bool m_ended = false;
+
+    static void CloseSocket(SocketHandle socket)
+    {
+#if defined(_WIN32)
+        closesocket(socket);
+#else
+        close(socket);
+#endif
+    }
+
+    // Returns 1 if socket can be read, 0 on timeout, and -1 on error.
+    static int WaitReadable(SocketHandle socket)
+    {
+#if defined(_WIN32)
+        WSAPOLLFD descriptor = { socket, POLLRDNORM, 0 };
+        return WSAPoll(&descriptor, 1, pollTimeoutMilliseconds);
+#else
+        pollfd descriptor = { socket, POLLIN, 0 };
+        return poll(&descriptor, 1, pollTimeoutMilliseconds);
+#endif
+    }
+
+    // Reads up to size bytes of input into buffer. Returns the number of bytes read, 0 if no input
+    // arrived before the poll timeout, or -1 if the input has ended or failed.
+    int ReadInput(uint8_t* buffer, size_t size)
+    {
+        if (!m_socketPath.empty())
+        {
+            auto ready = WaitReadable(m_socket);
+            if (ready <= 0)
+            {
+                return ready;
+            }
+            auto length = recv(m_socket, (char*)buffer, (int)size, 0);
+            return length > 0 ? (int)length : -1;
+        }
+#if defined(_WIN32)
+        // A pipe cannot be polled, so check how much input it has. Redirected files are read directly.
+        DWORD available = 0;
+        if (PeekNamedPipe(GetStdHandle(STD_INPUT_HANDLE), nullptr, 0, nullptr, &available, nullptr) && 0 == available)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(pollTimeoutMilliseconds / 10));
+            return 0;
+        }
+        auto length = _read(_fileno(stdin), buffer, (unsigned int)size);
+#else
+        auto ready = WaitReadable(STDIN_FILENO);
+        if (ready <= 0)
+        {
+            return ready;
+        }
+        auto length = read(STDIN_FILENO, buffer, size);
+#endif
+        return length > 0 ? (int)length : -1;
+    }
+
+    // Waits for a client to connect to the socket. Returns false if the source is stopped first.
+    bool Accept()
+    {
+        while (!m_stopping.load())
+        {
+            auto ready = WaitReadable(m_listener);
+            if (ready < 0)
+            {
+                return false;
+            }
+            if (ready > 0)
+            {
+                m_socket = accept(m_listener, nullptr, nullptr);
+                return invalidSocket != m_socket;
+            }
+        }
+        return false;
+    }
+
+    void Listen()
+    {
+#if defined(_WIN32)
+        WSADATA data;
+        if (0 != WSAStartup(MAKEWORD(2, 2), &data))
+        {
+            throw std::runtime_error("Failed to initialize Windows Sockets.");
+        }
+#endif
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (m_socketPath.length() >= sizeof(address.sun_path))
+        {
+            throw std::invalid_argument("The socket path is too long: " + m_socketPath);
+        }
+        std::strncpy(address.sun_path, m_socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+        // Remove a socket file left by an earlier run, which would make bind() fail.
+        std::error_code ignored;
+        std::filesystem::remove(m_socketPath, ignored);
+
+        m_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (invalidSocket == m_listener
+            || 0 != bind(m_listener, (sockaddr*)&address, sizeof(address))
+            || 0 != listen(m_listener, 1))
+        {
+            CloseSockets();
+            throw std::runtime_error("Failed to listen on the socket " + m_socketPath + ".");
+        }
+    }
+
+    void CloseSockets()
+    {
+        if (invalidSocket != m_socket)
+        {
+            CloseSocket(m_socket);
+            m_socket = invalidSocket;
+        }
+        if (invalidSocket != m_listener)
+        {
+            CloseSocket(m_listener);
+            m_listener = invalidSocket;
+            std::error_code ignored;
+            std::filesystem::remove(m_socketPath, ignored);
+#if defined(_WIN32)
+            WSACleanup();
+#endif
+        }
+    }
+
+protected:
+
+    int ReadSource(uint8_t* dataBuffer, uint32_t size) override
+    {
+        if (!m_ended && !m_socketPath.empty() && invalidSocket == m_socket && !Accept())
+        {
+            m_ended = true;
+        }
+        while (!m_ended && !m_stopping.load())
+        {
+            auto length = ReadInput(dataBuffer, size);
+            if (length > 0)
+            {
+                return length;
+            }
+            m_ended = length < 0;
+        }
+        return 0;
+    }
+
+public:
+
+    // source: "-" for standard input, or the path of a UNIX domain socket to listen on for one client.
+    StreamAudioSource(const std::string& source) : m_socketPath("-" == source ? "" : source)
+    {
+        if (m_socketPath.empty())
+        {
+#if defined(_WIN32)
+            // Otherwise the C runtime translates line endings in the audio.
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        }
+        else
+        {
+            Listen();
+        }
+    }
+
+    ~StreamAudioSource()
+    {
+        CloseSockets();
+    }
+
+    StreamAudioSource(const StreamAudioSource&) = delete;
+    StreamAudioSource& operator=(const StreamAudioSource&) = delete;
+
+    void Stop() override
+    {
+        m_stopping = true;
+    }
+};
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class StringHelper
@@ -29,7 +30,7 @@ public:
         {
             return false;
         }
-        for (int i = 0; i < str.length(); i++)
+        for (size_t i = 0; i < str.length(); i++)
         {
             if (i == 8 || i == 13 || i == 18 || i == 23)
             {
@@ -66,6 +67,29 @@ public:
         return retval;
     }
 
+    static std::string Join(const std::vector<std::string_view>& xs, std::string_view delimiter)
+    {
+        // Reserve the final size so the result is allocated once.
+        size_t length = 0;
+        for (const auto& x : xs)
+        {
+            length += x.length() + delimiter.length();
+        }
+
+        std::string retval;
+        retval.reserve(length);
+        for (std::vector<std::string_view>::const_iterator i = xs.begin(); i != xs.end(); ++i)
+        {
+            retval += *i;
+            if (i != xs.end() - 1)
+            {
+                retval += delimiter;
+            }
+        }
+
+        return retval;
+    }
+
     static std::string LeftTrim(std::string str)
     {
         str.erase(str.begin(), std::find_if(str.begin(), str.end(), [](unsigned char ch) { return !std::isspace(ch); }));
@@ -90,6 +114,11 @@ public:
         return tokens;
     }
 
+    static bool StartsWith(std::string_view str, std::string_view prefix)
+    {
+        return (str.size() >= prefix.size()) && (0 == str.compare(0, prefix.size(), prefix));
+    }
+
     static std::string ToLower(std::string str)
     {
         std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c){ return std::tolower(c); });
@@ -100,4 +129,19 @@ public:
     {
         return LeftTrim(RightTrim(str));
     }
+
+    // Like Trim, but returns a view into str instead of a copy.
+    static std::string_view TrimView(std::string_view str)
+    {
+        auto isSpace = [](unsigned char ch) { return std::isspace(ch); };
+        while (!str.empty() && isSpace(str.front()))
+        {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && isSpace(str.back()))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
 };
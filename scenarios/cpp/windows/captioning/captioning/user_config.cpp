@@ -6,12 +6,16 @@
 #include <algorithm>
 #include <cctype>
 #include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <optional>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
+#include <nlohmann/json.hpp>
 #include "string_helper.h"
 #include "user_config.h"
 
@@ -99,6 +103,36 @@ std::string GetEnvironmentVariable(const char* name)
 #endif
 }
 
+static CaptionFormat GetCaptionFormat(char** begin, char** end)
+{
+    std::optional<std::string> format = GetCommandLineOption(begin, end, "--captionFormat");
+    if (!format.has_value())
+    {
+        return CommandLineOptionExists(begin, end, "--srt") ? CaptionFormat::SubRip : CaptionFormat::WebVtt;
+    }
+    std::string value = StringHelper::ToLower(format.value());
+    if ("srt" == value)
+    {
+        return CaptionFormat::SubRip;
+    }
+    else if ("ttml" == value)
+    {
+        return CaptionFormat::Ttml;
+    }
+    else if ("jsonl" == value)
+    {
+        return CaptionFormat::JsonLines;
+    }
+    else if ("binary" == value)
+    {
+        return CaptionFormat::Binary;
+    }
+    else
+    {
+        return CaptionFormat::WebVtt;
+    }
+}
+
 static ProfanityOption GetProfanityOption(char** begin, char** end)
 {
     std::optional<std::string> profanity = GetCommandLineOption(begin, end, "--profanity");
@@ -126,16 +160,20 @@ static ProfanityOption GetProfanityOption(char** begin, char** end)
 
 std::shared_ptr<UserConfig> UserConfigFromArgs(int argc, char* argv[], std::string usage)
 {   
+    // Replay and the input benchmark do not connect to the Speech service, so they do not need a key or region.
+    auto replayFile = GetCommandLineOption(argv, argv + argc, "--replay");
+    auto benchmarkInput = CommandLineOptionExists(argv, argv + argc, "--benchmarkInput");
+
     std::optional<std::string> keyOption = GetCommandLineOption(argv, argv + argc, "--key");
     std::string key = keyOption.has_value() ? keyOption.value() : GetEnvironmentVariable("SPEECH_KEY");
-    if (0 == size(key))
+    if (0 == size(key) && !replayFile.has_value() && !benchmarkInput)
     {
         throw std::invalid_argument("Please set the SPEECH_KEY environment variable or provide a Speech resource key with the --key option.\n" + usage);
     }
 
     std::optional<std::string> regionOption = GetCommandLineOption(argv, argv + argc, "--region");
     std::string region = regionOption.has_value() ? regionOption.value() : GetEnvironmentVariable("SPEECH_REGION");
-    if (0 == size(region))
+    if (0 == size(region) && !replayFile.has_value() && !benchmarkInput)
     {
         throw std::invalid_argument("Please set the SPEECH_REGION environment variable or provide a Speech resource region with the --region option.\n" + usage);
     }
@@ -171,6 +209,17 @@ std::shared_ptr<UserConfig> UserConfigFromArgs(int argc, char* argv[], std::stri
         }
     }
     
+    std::optional<std::string> strCoalesce = GetCommandLineOption(argv, argv + argc, "--coalesce");
+    int coalesce = 0;
+    if (strCoalesce.has_value())
+    {
+        coalesce = std::stoi(strCoalesce.value());
+        if (coalesce < 0)
+        {
+            coalesce = 0;
+        }
+    }
+    
     std::optional<std::string> strMaxLineLength = GetCommandLineOption(argv, argv + argc, "--maxLineLength");
     int maxLineLength = UserConfig::defaultMaxLineLengthSBCS;
     if (strMaxLineLength.has_value())
@@ -193,23 +242,373 @@ std::shared_ptr<UserConfig> UserConfigFromArgs(int argc, char* argv[], std::stri
         }
     }
 
-    return std::make_shared<UserConfig>(
-        CommandLineOptionExists(argv, argv + argc, "--format"),
-        GetCompressedAudioFormat(argv, argv + argc),
-        GetProfanityOption(argv, argv + argc),
-        language,
-        GetCommandLineOption(argv, argv + argc, "--input"),
-        GetCommandLineOption(argv, argv + argc, "--output"),
-        GetCommandLineOption(argv, argv + argc, "--phrases"),
-        CommandLineOptionExists(argv, argv + argc, "--quiet"),
-        captioningMode,
-        remainTime,
-        delay,
-        CommandLineOptionExists(argv, argv + argc, "--srt"),
-        maxLineLength,
-        lines,        
-        GetCommandLineOption(argv, argv + argc, "--threshold"),
-        key,
-        region
-    );
+    std::optional<std::string> strFlushCaptions = GetCommandLineOption(argv, argv + argc, "--flushCaptions");
+    int flushCaptions = 1;
+    if (strFlushCaptions.has_value())
+    {
+        flushCaptions = std::stoi(strFlushCaptions.value());
+        if (flushCaptions < 1)
+        {
+            flushCaptions = 1;
+        }
+    }
+
+    std::optional<std::string> strFlushInterval = GetCommandLineOption(argv, argv + argc, "--flushInterval");
+    int flushInterval = 0;
+    if (strFlushInterval.has_value())
+    {
+        flushInterval = std::stoi(strFlushInterval.value());
+        if (flushInterval < 0)
+        {
+            flushInterval = 0;
+        }
+    }
+
+    std::optional<std::string> strWorkers = GetCommandLineOption(argv, argv + argc, "--workers");
+    int workers = std::max(1, (int)std::thread::hardware_concurrency());
+    if (strWorkers.has_value())
+    {
+        workers = std::stoi(strWorkers.value());
+        if (workers < 1)
+        {
+            workers = 1;
+        }
+    }
+
+    std::optional<std::string> strParallelSegments = GetCommandLineOption(argv, argv + argc, "--parallel");
+    int parallelSegments = 1;
+    if (strParallelSegments.has_value())
+    {
+        parallelSegments = std::stoi(strParallelSegments.value());
+        if (parallelSegments < 1)
+        {
+            parallelSegments = 1;
+        }
+    }
+
+    std::optional<std::string> strServePort = GetCommandLineOption(argv, argv + argc, "--serve");
+    int servePort = 0;
+    if (strServePort.has_value())
+    {
+        servePort = std::stoi(strServePort.value());
+        if (servePort < 1 || servePort > 65535)
+        {
+            throw std::invalid_argument("The --serve port must be between 1 and 65535.\n" + usage);
+        }
+    }
+
+    std::optional<std::string> strSegmentDuration = GetCommandLineOption(argv, argv + argc, "--segmentDuration");
+    int segmentDuration = 6;
+    if (strSegmentDuration.has_value())
+    {
+        segmentDuration = std::stoi(strSegmentDuration.value());
+        if (segmentDuration < 1)
+        {
+            segmentDuration = 1;
+        }
+    }
+
+    std::optional<std::string> strPlaylistLength = GetCommandLineOption(argv, argv + argc, "--playlistLength");
+    int playlistLength = 10;
+    if (strPlaylistLength.has_value())
+    {
+        playlistLength = std::stoi(strPlaylistLength.value());
+        if (playlistLength < 1)
+        {
+            playlistLength = 1;
+        }
+    }
+
+    std::vector<std::string> targetLanguages;
+    std::optional<std::string> strTargetLanguages = GetCommandLineOption(argv, argv + argc, "--translate");
+    if (strTargetLanguages.has_value())
+    {
+        for (const auto& targetLanguage : StringHelper::Split(strTargetLanguages.value(), ';'))
+        {
+            if (!targetLanguage.empty())
+            {
+                targetLanguages.push_back(targetLanguage);
+            }
+        }
+        if (!GetCommandLineOption(argv, argv + argc, "--output").has_value())
+        {
+            throw std::invalid_argument("--translate requires --output, because each language is written to its own file.\n" + usage);
+        }
+        if (CommandLineOptionExists(argv, argv + argc, "--manifest") || parallelSegments > 1 || replayFile.has_value())
+        {
+            throw std::invalid_argument("--translate cannot be combined with --manifest, --parallel or --replay.\n" + usage);
+        }
+    }
+
+    // Parallel segments and manifest sessions are recognized separately, so there is no one stream of events to record.
+    if (CommandLineOptionExists(argv, argv + argc, "--record")
+        && (CommandLineOptionExists(argv, argv + argc, "--manifest") || parallelSegments > 1))
+    {
+        throw std::invalid_argument("--record cannot be combined with --manifest or --parallel.\n" + usage);
+    }
+
+    std::optional<std::string> pcmSource = GetCommandLineOption(argv, argv + argc, "--pcm");
+    if (pcmSource.has_value()
+        && (CommandLineOptionExists(argv, argv + argc, "--input") || CommandLineOptionExists(argv, argv + argc, "--manifest") || parallelSegments > 1 || replayFile.has_value()))
+    {
+        throw std::invalid_argument("--pcm cannot be combined with --input, --manifest, --parallel or --replay.\n" + usage);
+    }
+
+    std::optional<std::string> strPcmSampleRate = GetCommandLineOption(argv, argv + argc, "--pcmRate");
+    int pcmSampleRate = 16000;
+    if (strPcmSampleRate.has_value())
+    {
+        pcmSampleRate = std::stoi(strPcmSampleRate.value());
+        if (pcmSampleRate < 8000)
+        {
+            pcmSampleRate = 16000;
+        }
+    }
+
+    std::optional<std::string> strPcmChannels = GetCommandLineOption(argv, argv + argc, "--pcmChannels");
+    int pcmChannels = 1;
+    if (strPcmChannels.has_value())
+    {
+        pcmChannels = std::stoi(strPcmChannels.value());
+        if (pcmChannels < 1)
+        {
+            pcmChannels = 1;
+        }
+    }
+
+    std::optional<std::string> strChunkMilliseconds = GetCommandLineOption(argv, argv + argc, "--chunk");
+    int chunkMilliseconds = 100;
+    if (strChunkMilliseconds.has_value())
+    {
+        chunkMilliseconds = std::stoi(strChunkMilliseconds.value());
+        if (chunkMilliseconds < 10)
+        {
+            chunkMilliseconds = 10;
+        }
+        else if (chunkMilliseconds > 1000)
+        {
+            chunkMilliseconds = 1000;
+        }
+    }
+
+    std::optional<std::string> strAudioBufferMilliseconds = GetCommandLineOption(argv, argv + argc, "--audioBuffer");
+    int audioBufferMilliseconds = 2000;
+    if (strAudioBufferMilliseconds.has_value())
+    {
+        audioBufferMilliseconds = std::stoi(strAudioBufferMilliseconds.value());
+        if (audioBufferMilliseconds < 2 * chunkMilliseconds)
+        {
+            audioBufferMilliseconds = 2 * chunkMilliseconds;
+        }
+    }
+
+    std::optional<std::string> strReadAheadMegabytes = GetCommandLineOption(argv, argv + argc, "--readAhead");
+    int readAheadMegabytes = 0;
+    if (strReadAheadMegabytes.has_value())
+    {
+        readAheadMegabytes = std::stoi(strReadAheadMegabytes.value());
+        if (readAheadMegabytes < 0)
+        {
+            readAheadMegabytes = 0;
+        }
+    }
+
+    std::optional<std::string> strInputChannel = GetCommandLineOption(argv, argv + argc, "--inputChannel");
+    std::optional<int> inputChannel = std::nullopt;
+    if (strInputChannel.has_value())
+    {
+        if ("mix" == strInputChannel.value())
+        {
+            inputChannel = 0;
+        }
+        else
+        {
+            inputChannel = std::stoi(strInputChannel.value());
+            if (inputChannel.value() < 1)
+            {
+                inputChannel = 1;
+            }
+        }
+    }
+
+    std::optional<std::string> strResampleRate = GetCommandLineOption(argv, argv + argc, "--sampleRate");
+    std::optional<int> resampleRate = std::nullopt;
+    if (strResampleRate.has_value())
+    {
+        resampleRate = std::stoi(strResampleRate.value());
+        if (resampleRate.value() < 8000)
+        {
+            resampleRate = 8000;
+        }
+    }
+
+    std::optional<std::string> strPaceSpeed = GetCommandLineOption(argv, argv + argc, "--pace");
+    std::optional<double> paceSpeed = std::nullopt;
+    if (strPaceSpeed.has_value() && "max" != strPaceSpeed.value())
+    {
+        paceSpeed = std::stod(strPaceSpeed.value());
+        if (paceSpeed.value() < 0.1)
+        {
+            paceSpeed = 0.1;
+        }
+    }
+
+    auto inputFile = GetCommandLineOption(argv, argv + argc, "--input");
+    auto wavInput = inputFile.has_value() && StringHelper::EndsWith(inputFile.value(), ".wav");
+    if (benchmarkInput && !wavInput)
+    {
+        throw std::invalid_argument("--benchmarkInput requires a WAV --input file.\n" + usage);
+    }
+    if (inputChannel.has_value() && !wavInput)
+    {
+        throw std::invalid_argument("--inputChannel requires a WAV --input file.\n" + usage);
+    }
+    if (resampleRate.has_value() && !wavInput && !pcmSource.has_value())
+    {
+        throw std::invalid_argument("--sampleRate requires a WAV --input file or --pcm.\n" + usage);
+    }
+    if (paceSpeed.has_value() && !wavInput && !pcmSource.has_value())
+    {
+        throw std::invalid_argument("--pace requires a WAV --input file or --pcm.\n" + usage);
+    }
+
+    CaptionFormat captionFormat = GetCaptionFormat(argv, argv + argc);
+    if (CaptionFormat::Binary == captionFormat && servePort > 0)
+    {
+        throw std::invalid_argument("The binary caption format cannot be served with --serve.\n" + usage);
+    }
+
+    auto retval = std::make_shared<UserConfig>();
+    retval->useCompressedAudio = CommandLineOptionExists(argv, argv + argc, "--format");
+    retval->compressedAudioFormat = GetCompressedAudioFormat(argv, argv + argc);
+    retval->profanityOption = GetProfanityOption(argv, argv + argc);
+    retval->language = language;
+    retval->inputFile = GetCommandLineOption(argv, argv + argc, "--input");
+    retval->outputFile = GetCommandLineOption(argv, argv + argc, "--output");
+    retval->phraseList = GetCommandLineOption(argv, argv + argc, "--phrases");
+    retval->suppressConsoleOutput = CommandLineOptionExists(argv, argv + argc, "--quiet");
+    retval->captioningMode = captioningMode;
+    retval->remainTime = remainTime;
+    retval->delay = delay;
+    retval->coalesce = coalesce;
+    retval->captionFormat = captionFormat;
+    retval->maxLineLength = maxLineLength;
+    retval->lines = lines;
+    retval->stablePartialResultThreshold = GetCommandLineOption(argv, argv + argc, "--threshold");
+    retval->useWordTimings = CommandLineOptionExists(argv, argv + argc, "--wordTimings");
+    retval->flushCaptions = flushCaptions;
+    retval->flushInterval = flushInterval;
+    retval->durableOutput = CommandLineOptionExists(argv, argv + argc, "--durable");
+    retval->manifestFile = GetCommandLineOption(argv, argv + argc, "--manifest");
+    retval->workers = workers;
+    retval->parallelSegments = parallelSegments;
+    retval->recordFile = GetCommandLineOption(argv, argv + argc, "--record");
+    retval->replayFile = replayFile;
+    retval->servePort = servePort;
+    retval->segmentDirectory = GetCommandLineOption(argv, argv + argc, "--segments");
+    retval->segmentDuration = segmentDuration;
+    retval->playlistLength = playlistLength;
+    retval->targetLanguages = targetLanguages;
+    retval->pcmSource = pcmSource;
+    retval->pcmSampleRate = pcmSampleRate;
+    retval->pcmChannels = pcmChannels;
+    retval->chunkMilliseconds = chunkMilliseconds;
+    retval->audioBufferMilliseconds = audioBufferMilliseconds;
+    retval->readAheadMegabytes = readAheadMegabytes;
+    retval->benchmarkInput = benchmarkInput;
+    retval->inputChannel = inputChannel;
+    retval->resampleRate = resampleRate;
+    retval->paceSpeed = paceSpeed;
+    retval->subscriptionKey = key;
+    retval->region = region;
+    return retval;
+}
+
+// Returns a copy of userConfig for one session in a manifest.
+// Sessions write captions to their output files only, because console output from many sessions would be interleaved.
+std::shared_ptr<UserConfig> UserConfigForSession(std::shared_ptr<UserConfig> userConfig, std::string inputFile, std::optional<std::string> outputFile)
+{
+    auto retval = std::make_shared<UserConfig>(*userConfig);
+    retval->inputFile = inputFile;
+    retval->outputFile = outputFile;
+    retval->suppressConsoleOutput = true;
+    retval->manifestFile = std::nullopt;
+    retval->parallelSegments = 1;
+    retval->recordFile = std::nullopt;
+    retval->replayFile = std::nullopt;
+    retval->servePort = 0;
+    retval->segmentDirectory = std::nullopt;
+    retval->targetLanguages.clear();
+    retval->pcmSource = std::nullopt;
+    retval->benchmarkInput = false;
+    return retval;
+}
+
+// Returns a copy of userConfig for the caption track in one target language.
+// The track is written to userConfig->outputFile with the language inserted before the extension,
+// for example captions.de.vtt, and not to the console, the caption server or the segment directory.
+// Word timings refer to the recognized text, not the translation, so the track does not use them.
+// Only the primary recognizer reads the input, so the track has none.
+std::shared_ptr<UserConfig> UserConfigForTranslation(std::shared_ptr<UserConfig> userConfig, std::string language)
+{
+    std::filesystem::path outputFile(userConfig->outputFile.value());
+    auto extension = outputFile.extension();
+    outputFile.replace_extension();
+    outputFile += "." + language;
+    outputFile += extension;
+
+    auto retval = std::make_shared<UserConfig>(*userConfig);
+    retval->language = language;
+    retval->outputFile = outputFile.string();
+    retval->suppressConsoleOutput = true;
+    retval->useWordTimings = false;
+    retval->manifestFile = std::nullopt;
+    retval->parallelSegments = 1;
+    retval->recordFile = std::nullopt;
+    retval->replayFile = std::nullopt;
+    retval->servePort = 0;
+    retval->segmentDirectory = std::nullopt;
+    retval->targetLanguages.clear();
+    retval->useCompressedAudio = false;
+    retval->inputFile = std::nullopt;
+    retval->pcmSource = std::nullopt;
+    retval->readAheadMegabytes = 0;
+    retval->benchmarkInput = false;
+    retval->inputChannel = std::nullopt;
+    retval->resampleRate = std::nullopt;
+    retval->paceSpeed = std::nullopt;
+    return retval;
+}
+
+// Reads the manifest named by userConfig->manifestFile. The manifest is a JSON array with one object per session:
+// [ { "input": "channel1.wav", "output": "channel1.vtt" }, ... ]
+std::vector<std::shared_ptr<UserConfig>> UserConfigsFromManifest(std::shared_ptr<UserConfig> userConfig)
+{
+    std::ifstream manifestStream(userConfig->manifestFile.value());
+    if (!manifestStream.good())
+    {
+        throw std::invalid_argument("Failed to open the manifest file: " + userConfig->manifestFile.value());
+    }
+
+    auto manifest = nlohmann::json::parse(manifestStream, nullptr, false);
+    if (manifest.is_discarded() || !manifest.is_array())
+    {
+        throw std::invalid_argument("The manifest must be a JSON array of { \"input\": FILE, \"output\": FILE } objects.");
+    }
+
+    std::vector<std::shared_ptr<UserConfig>> retval;
+    for (const auto& session : manifest)
+    {
+        if (!session.is_object() || !session.contains("input") || !session["input"].is_string())
+        {
+            throw std::invalid_argument("Each session in the manifest must have an \"input\" file.");
+        }
+        std::optional<std::string> outputFile = std::nullopt;
+        if (session.contains("output") && session["output"].is_string())
+        {
+            outputFile = session["output"].get<std::string>();
+        }
+        retval.push_back(UserConfigForSession(userConfig, session["input"].get<std::string>(), outputFile));
+    }
+    return retval;
 }
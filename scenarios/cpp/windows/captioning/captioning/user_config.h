@@ -18,69 +18,78 @@ enum CaptioningMode
     RealTime
 };
 
+enum CaptionFormat
+{
+    WebVtt,
+    SubRip,
+    Ttml,
+    JsonLines,
+    Binary
+};
+
+// Options are plain fields with defaults. UserConfigFromArgs() sets them by name, and a config derived
+// from another, such as the config of a session, is a copy with only the fields that differ changed.
+// A config is not changed once it is shared.
 class UserConfig
 {
 public:
     const static int defaultMaxLineLengthSBCS = 37;
     const static int defaultMaxLineLengthMBCS = 30;
 
-    const bool useCompressedAudio = false;
-    const AudioStreamContainerFormat compressedAudioFormat = AudioStreamContainerFormat::ANY;
-    const ProfanityOption profanityOption = ProfanityOption::Masked;
-    const std::string language;
-    const std::optional<std::string> inputFile = std::nullopt;
-    const std::optional<std::string> outputFile = std::nullopt;
-    const std::optional<std::string> phraseList;
-    const bool suppressConsoleOutput = false;
-    const CaptioningMode captioningMode;
-    const int remainTime;
-    const int delay;
-    const bool useSubRipTextCaptionFormat = false;
-    const int maxLineLength;
-    const int lines;
-    const std::optional<std::string> stablePartialResultThreshold = std::nullopt;
-    const std::string subscriptionKey;
-    const std::string region;
-    
-    UserConfig(
-        bool useCompressedAudio,
-        AudioStreamContainerFormat compressedAudioFormat,
-        ProfanityOption profanityOption,
-        std::string language,
-        std::optional<std::string> inputFile,
-        std::optional<std::string> outputFile,
-        std::optional<std::string> phraseList,
-        bool suppressConsoleOutput,
-        CaptioningMode captioningMode,
-        int remainTime,
-        int delay,
-        bool useSubRipTextCaptionFormat,
-        int maxLineLength,
-        int lines,
-        std::optional<std::string> stablePartialResultThreshold,
-        std::string subscriptionKey,
-        std::string region
-        ) :
-        useCompressedAudio(useCompressedAudio),
-        compressedAudioFormat(compressedAudioFormat),
-        profanityOption(profanityOption),
-        language(language),
-        inputFile(inputFile),
-        outputFile(outputFile),
-        phraseList(phraseList),
-        suppressConsoleOutput(suppressConsoleOutput),
-        captioningMode(captioningMode),
-        remainTime(remainTime),
-        delay(delay),
-        useSubRipTextCaptionFormat(useSubRipTextCaptionFormat),
-        maxLineLength(maxLineLength),
-        lines(lines),
-        stablePartialResultThreshold(stablePartialResultThreshold),
-        subscriptionKey(subscriptionKey),
-        region(region)
-        {}
+    bool useCompressedAudio = false;
+    AudioStreamContainerFormat compressedAudioFormat = AudioStreamContainerFormat::ANY;
+    ProfanityOption profanityOption = ProfanityOption::Masked;
+    std::string language = "en-US";
+    std::optional<std::string> inputFile = std::nullopt;
+    std::optional<std::string> outputFile = std::nullopt;
+    std::optional<std::string> phraseList = std::nullopt;
+    bool suppressConsoleOutput = false;
+    CaptioningMode captioningMode = CaptioningMode::Offline;
+    int remainTime = 1000;
+    int delay = 1000;
+    int coalesce = 0;
+    CaptionFormat captionFormat = CaptionFormat::WebVtt;
+    int maxLineLength = defaultMaxLineLengthSBCS;
+    int lines = 2;
+    std::optional<std::string> stablePartialResultThreshold = std::nullopt;
+    bool useWordTimings = false;
+    int flushCaptions = 1;
+    int flushInterval = 0;
+    bool durableOutput = false;
+    std::optional<std::string> manifestFile = std::nullopt;
+    int workers = 1;
+    int parallelSegments = 1;
+    std::optional<std::string> recordFile = std::nullopt;
+    std::optional<std::string> replayFile = std::nullopt;
+    int servePort = 0;
+    std::optional<std::string> segmentDirectory = std::nullopt;
+    int segmentDuration = 6;
+    int playlistLength = 10;
+    // Languages to translate captions into, in addition to the recognized language. See --translate.
+    std::vector<std::string> targetLanguages;
+    // If set, audio is raw 16-bit PCM from standard input ("-") or a UNIX domain socket. See --pcm.
+    std::optional<std::string> pcmSource = std::nullopt;
+    int pcmSampleRate = 16000;
+    int pcmChannels = 1;
+    int chunkMilliseconds = 100;
+    int audioBufferMilliseconds = 2000;
+    int readAheadMegabytes = 0;
+    // If true, measure how fast the input WAV file can be read instead of recognizing it.
+    bool benchmarkInput = false;
+    // Channel of a WAV --input file to recognize, counting from 1, or 0 to mix all of its channels into one.
+    // If not set, all the channels are passed to the recognizer. See --inputChannel.
+    std::optional<int> inputChannel = std::nullopt;
+    // If set, WAV --input or --pcm audio is resampled to this rate before it is recognized. See --sampleRate.
+    std::optional<int> resampleRate = std::nullopt;
+    // If set, WAV --input or --pcm audio is released at this multiple of real time, as if it were live. See --pace.
+    std::optional<double> paceSpeed = std::nullopt;
+    std::string subscriptionKey;
+    std::string region;
 };
 
 bool CommandLineOptionExists(char** begin, char** end, const std::string& option);
 std::string getEnvironmentVariable(const char* name);
 std::shared_ptr<UserConfig> UserConfigFromArgs(int argc, char* argv[], std::string usage);
+std::shared_ptr<UserConfig> UserConfigForSession(std::shared_ptr<UserConfig> userConfig, std::string inputFile, std::optional<std::string> outputFile);
+std::shared_ptr<UserConfig> UserConfigForTranslation(std::shared_ptr<UserConfig> userConfig, std::string language);
+std::vector<std::shared_ptr<UserConfig>> UserConfigsFromManifest(std::shared_ptr<UserConfig> userConfig);
@@ -4,12 +4,22 @@
 //
 #pragma once
 
-#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <speechapi_cxx.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "audio_source.h"
+#include "mapped_file.h"
+#include "sample_conversion.h"
+
+using namespace Microsoft::CognitiveServices::Speech::Audio;
 
-// Adapted from code in:
-// https://github.com/Azure-Samples/cognitive-services-speech-sdk/blob/master/samples/cpp/windows/console/samples/wav_file_reader.h
 // The format structure expected in wav files.
-struct WAVEFORMAT
+// Not named WAVEFORMAT, which windows.h also defines.
+struct WavFormat
 {
     uint16_t FormatTag;        // format type.
     uint16_t Channels;         // number of channels (i.e. mono, stereo...).
@@ -17,139 +27,355 @@ struct WAVEFORMAT
     uint32_t AvgBytesPerSec;   // for buffer estimation.
     uint16_t BlockAlign;       // block size of data.
     uint16_t BitsPerSample;    // Number of bits per sample of mono data.
+    // From the WAVE_FORMAT_EXTENSIBLE extension, or 0 when the file does not have one.
+    uint16_t ValidBitsPerSample;   // bits of each sample that are used, at the top of BitsPerSample.
+    uint32_t ChannelMask;          // speaker position of each channel, as in KSAUDIO_SPEAKER_*.
+    // How each sample is stored, from the format tag, or the sub-format of an extensible format, and BitsPerSample.
+    SampleFormat Format;
 };
 
-class WavFileReader final
+// Adapted from code in:
+// https://github.com/Azure-Samples/cognitive-services-speech-sdk/blob/master/samples/cpp/windows/console/samples/wav_file_reader.h
+// Reads the audio data of a WAV file, without its header, from a memory-mapped view of the file.
+// The header is parsed once, when the reader is created, and Read() copies straight from the view.
+// Files can be RIFF, or RF64 or BW64 for audio data over 4 GB, and can have a WAVE_FORMAT_EXTENSIBLE
+// format. Samples can be 8, 16, 24 or 32-bit integers or 32 or 64-bit floating point, which Read()
+// converts to the 16-bit PCM the Speech SDK expects as it copies them, with the same sample rate.
+// Read() returns all the channels of the file, or one of them, or all of them mixed into one. See SelectChannel().
+class WavFileReader final : public AudioSource
 {
 private:
 
-    WAVEFORMAT m_formatHeader;
-    static_assert(sizeof(m_formatHeader) == 16, "unexpected size of m_formatHeader");
-
     // Defines common constants for WAV format.
-    static constexpr uint16_t tagBufferSize = 4;
-    static constexpr uint16_t chunkTypeBufferSize = 4;
-    static constexpr uint16_t chunkSizeBufferSize = 4;
+    static constexpr uint64_t tagSize = 4;
+    static constexpr uint64_t chunkHeaderSize = 8;
+    static constexpr uint64_t formatSize = 16;
+    static constexpr uint64_t extensibleFormatSize = 40;
+    static constexpr uint16_t formatTagPcm = 1;
+    static constexpr uint16_t formatTagFloat = 3;
+    static constexpr uint16_t formatTagExtensible = 0xFFFE;
+    // Every sub-format GUID of an extensible format ends with these bytes, after the 2-byte format tag.
+    static constexpr uint8_t subFormatSuffix[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+    // An RF64 chunk size that means the size is in the ds64 chunk.
+    static constexpr uint32_t sizeInDs64 = 0xFFFFFFFF;
+    static constexpr int allChannels = -2;
+    // Sample frames that are converted to 16 bits at a time, before one channel is taken from them.
+    static constexpr uint64_t blockFrames = 1024;
+    // Read-ahead is issued in windows of this size, which is the usual size of a huge page.
+    static constexpr uint64_t readAheadWindow = 2 * 1024 * 1024;
 
-    std::fstream m_fs;
+    MappedFile m_file;
+    WavFormat m_format = {};
+    uint64_t m_dataOffset = 0;
+    uint64_t m_dataSize = 0;
+    // The range of the file that Read() returns, and how far it has read.
+    uint64_t m_position = 0;
+    uint64_t m_end = 0;
+    // How far ahead of m_position to keep the file in memory, and how far it has been prefetched.
+    uint64_t m_readAhead = 0;
+    uint64_t m_prefetched = 0;
+    // Bytes of one sample frame as Read() returns it.
+    uint64_t m_outputBlockAlign = 0;
+    // The channel Read() returns, counting from 0, or allChannels or mixChannels.
+    int m_channel = allChannels;
+    // Samples converted to 16 bits, when Read() takes one channel of a file that is not 16-bit.
+    std::vector<uint8_t> m_block;
 
-    void ReadChunkTypeAndSize(char* chunkType, uint32_t* chunkSize)
+    uint16_t ReadUInt16(uint64_t offset) const
     {
-        // Read the chunk type
-        m_fs.read(chunkType, chunkTypeBufferSize);
-
-        // Read the chunk size
-        uint8_t chunkSizeBuffer[chunkSizeBufferSize];
-        m_fs.read((char*)chunkSizeBuffer, chunkSizeBufferSize);
-
-        // chunk size is little endian
-        *chunkSize = ((uint32_t)chunkSizeBuffer[3] << 24) |
-            ((uint32_t)chunkSizeBuffer[2] << 16) |
-            ((uint32_t)chunkSizeBuffer[1] << 8) |
-            (uint32_t)chunkSizeBuffer[0];
+        auto data = m_file.View(offset, 2);
+        return (uint16_t)(data[0] | (data[1] << 8));
     }
 
-    // Get format data from a wav file.
-    void GetFormatFromWavFile()
+    uint32_t ReadUInt32(uint64_t offset) const
     {
-        char tag[tagBufferSize];
-        char chunkType[chunkTypeBufferSize];
-        char chunkSizeBuffer[chunkSizeBufferSize];
-        uint32_t chunkSize = 0;
+        auto data = m_file.View(offset, 4);
+        return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
 
-        // Set to throw exceptions when reading file header.
-        m_fs.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    uint64_t ReadUInt64(uint64_t offset) const
+    {
+        return (uint64_t)ReadUInt32(offset) | ((uint64_t)ReadUInt32(offset + 4) << 32);
+    }
 
-        try
+    static SampleFormat SampleFormatOf(uint16_t formatTag, uint16_t bitsPerSample)
+    {
+        if (formatTagPcm == formatTag)
         {
-            // Checks the RIFF tag
-            m_fs.read(tag, tagBufferSize);
-            if (memcmp(tag, "RIFF", tagBufferSize) != 0)
+            switch (bitsPerSample)
             {
-                throw std::runtime_error("Invalid file header, tag 'RIFF' is expected.");
+            case 8: return SampleFormat::UInt8;
+            case 16: return SampleFormat::Int16;
+            case 24: return SampleFormat::Int24;
+            case 32: return SampleFormat::Int32;
             }
+        }
+        else if (formatTagFloat == formatTag)
+        {
+            switch (bitsPerSample)
+            {
+            case 32: return SampleFormat::Float32;
+            case 64: return SampleFormat::Float64;
+            }
+        }
+        return SampleFormat::Unsupported;
+    }
 
-            // The next is the RIFF chunk size, ignore now.
-            m_fs.read(chunkSizeBuffer, chunkSizeBufferSize);
+    void ReadFormatChunk(uint64_t chunkData, uint64_t chunkSize)
+    {
+        auto size = m_file.Size();
+        if (chunkSize < formatSize || chunkData + formatSize > size)
+        {
+            throw std::runtime_error("Invalid format chunk.");
+        }
+        m_format.FormatTag = ReadUInt16(chunkData);
+        m_format.Channels = ReadUInt16(chunkData + 2);
+        m_format.SamplesPerSec = ReadUInt32(chunkData + 4);
+        m_format.AvgBytesPerSec = ReadUInt32(chunkData + 8);
+        m_format.BlockAlign = ReadUInt16(chunkData + 12);
+        m_format.BitsPerSample = ReadUInt16(chunkData + 14);
 
-            // Checks the 'WAVE' tag in the wave header.
-            m_fs.read(chunkType, chunkTypeBufferSize);
-            if (memcmp(chunkType, "WAVE", chunkTypeBufferSize) != 0)
+        auto formatTag = m_format.FormatTag;
+        if (formatTagExtensible == formatTag)
+        {
+            if (chunkSize < extensibleFormatSize || chunkData + extensibleFormatSize > size)
             {
-                throw std::runtime_error("Invalid file header, tag 'WAVE' is expected.");
+                throw std::runtime_error("Invalid extensible format chunk.");
             }
-            
-            bool foundDataChunk = false;
-            while (!foundDataChunk && m_fs.good() && !m_fs.eof())
-            {
-                ReadChunkTypeAndSize(chunkType, &chunkSize);
-                if (memcmp(chunkType, "fmt ", chunkTypeBufferSize) == 0)
-                {
-                    // Reads format data.
-                    m_fs.read((char *)&m_formatHeader, sizeof(m_formatHeader));
+            // The 2-byte size of the extension follows the basic format.
+            m_format.ValidBitsPerSample = ReadUInt16(chunkData + 18);
+            m_format.ChannelMask = ReadUInt32(chunkData + 20);
+            formatTag = 0 == memcmp(m_file.View(chunkData + 26, sizeof(subFormatSuffix)), subFormatSuffix, sizeof(subFormatSuffix)) ? ReadUInt16(chunkData + 24) : 0;
+        }
+        m_format.Format = SampleFormatOf(formatTag, m_format.BitsPerSample);
 
-                    // Skips the rest of format data.
-                    if (chunkSize > sizeof(m_formatHeader))
-                    {
-                        m_fs.seekg(chunkSize - sizeof(m_formatHeader), std::ios_base::cur);
-                    }
-                }
-                else if (memcmp(chunkType, "data", chunkTypeBufferSize) == 0)
-                {
-                    foundDataChunk = true;
-                    break;
-                }
-                else
+        if (SampleFormat::Unsupported == m_format.Format)
+        {
+            throw std::runtime_error("Unsupported WAV format. Only 8, 16, 24 and 32-bit PCM and 32 and 64-bit floating point are supported.");
+        }
+        if (0 == m_format.Channels || m_format.BlockAlign != m_format.Channels * BytesPerSample(m_format.Format))
+        {
+            throw std::runtime_error("Invalid format chunk.");
+        }
+    }
+
+    bool TagAt(uint64_t offset, const char* tag) const
+    {
+        return 0 == memcmp(m_file.View(offset, tagSize), tag, tagSize);
+    }
+
+    // Get format data from a wav file.
+    void GetFormatFromWavFile()
+    {
+        auto size = m_file.Size();
+        if (size < 3 * tagSize || !(TagAt(0, "RIFF") || TagAt(0, "RF64") || TagAt(0, "BW64")))
+        {
+            throw std::runtime_error("Invalid file header, tag 'RIFF', 'RF64' or 'BW64' is expected.");
+        }
+        // The RIFF chunk size follows, which is not needed.
+        if (!TagAt(2 * tagSize, "WAVE"))
+        {
+            throw std::runtime_error("Invalid file header, tag 'WAVE' is expected.");
+        }
+
+        bool foundFormatChunk = false;
+        // The 64-bit size of the data chunk, from the ds64 chunk that starts an RF64 or BW64 file.
+        uint64_t ds64DataSize = 0;
+        bool foundDs64Chunk = false;
+        uint64_t offset = 3 * tagSize;
+        while (offset + chunkHeaderSize <= size)
+        {
+            uint64_t chunkSize = ReadUInt32(offset + tagSize);
+            auto chunkData = offset + chunkHeaderSize;
+            if (TagAt(offset, "ds64"))
+            {
+                // The RIFF size comes first, then the data size.
+                if (chunkSize < 16 || chunkData + 16 > size)
                 {
-                    m_fs.seekg(chunkSize, std::ios_base::cur);
+                    throw std::runtime_error("Invalid ds64 chunk.");
                 }
+                ds64DataSize = ReadUInt64(chunkData + 8);
+                foundDs64Chunk = true;
             }
-
-            if (!foundDataChunk)
+            else if (TagAt(offset, "fmt "))
             {
-                throw std::runtime_error("Did not find data chunk.");
+                ReadFormatChunk(chunkData, chunkSize);
+                foundFormatChunk = true;
             }
-            if (m_fs.eof() && chunkSize > 0)
+            else if (TagAt(offset, "data"))
             {
-                throw std::runtime_error("Unexpected end of file, before any audio data can be read.");
+                if (!foundFormatChunk)
+                {
+                    throw std::runtime_error("Did not find format chunk before data chunk.");
+                }
+                if (foundDs64Chunk && sizeInDs64 == chunkSize)
+                {
+                    chunkSize = ds64DataSize;
+                }
+                // Recorders that are stopped before they write the header leave the size at 0 or too large,
+                // and some writers of RIFF files over 4 GB leave it at its largest value,
+                // so the data is taken to run to the end of the file in those cases.
+                m_dataOffset = chunkData;
+                m_dataSize = 0 == chunkSize || sizeInDs64 == chunkSize ? size - chunkData : std::min(chunkSize, size - chunkData);
+                return;
             }
+            // Chunks are padded to an even size.
+            offset = chunkData + chunkSize + (chunkSize & 1);
         }
-        catch (std::ifstream::failure e)
+        throw std::runtime_error("Did not find data chunk.");
+    }
+
+public:
+
+    // Constructor that creates an input stream from the audio data in a file.
+    WavFileReader(const std::string& audioFileName) : m_file(audioFileName)
+    {
+        // Get audio format from the file header.
+        GetFormatFromWavFile();
+        m_outputBlockAlign = m_format.Channels * sizeof(int16_t);
+        m_position = m_dataOffset;
+        m_end = m_dataOffset + m_dataSize;
+    }
+
+    // Constructor that creates an input stream from length bytes of the audio data, starting at
+    // position begin in the file.
+    WavFileReader(const std::string& audioFileName, uint64_t begin, uint64_t length) : WavFileReader(audioFileName)
+    {
+        if (begin < m_dataOffset || begin > m_end || length > m_end - begin)
         {
-            throw std::runtime_error("Unexpected end of file or error when reading audio file.");
+            throw std::invalid_argument("The range is outside the audio data.");
         }
-        // Set to not throw exceptions when starting to read audio data
-        m_fs.exceptions(std::ifstream::goodbit);
+        m_position = begin;
+        m_end = begin + length;
     }
-    
-public:
 
-    // Constructor that creates an input stream from a file.
-    WavFileReader(const std::string& audioFileName)
+    // For SelectChannel(), to mix all the channels into one.
+    static constexpr int mixChannels = -1;
+
+    // Gets the format of the audio in the file. Read() returns it as 16-bit PCM.
+    WavFormat GetFormat() const
     {
-        if (audioFileName.empty())
+        return m_format;
+    }
+
+    // Makes Read() return only the given channel, counting from 0, or, if channel is mixChannels,
+    // the mean of all the channels.
+    void SelectChannel(int channel)
+    {
+        if (mixChannels != channel && (channel < 0 || channel >= m_format.Channels))
         {
-            throw std::invalid_argument("Audio filename is empty");
+            throw std::invalid_argument("The audio file has only " + std::to_string(m_format.Channels) + " channels.");
         }
+        m_channel = channel;
+        m_outputBlockAlign = sizeof(int16_t);
+        if (SampleFormat::Int16 != m_format.Format)
+        {
+            m_block.resize((size_t)(blockFrames * m_format.Channels * sizeof(int16_t)));
+        }
+    }
+
+    // Gets the number of channels Read() returns.
+    int GetOutputChannels() const
+    {
+        return (int)(m_outputBlockAlign / sizeof(int16_t));
+    }
+
+    // Gets the position of the audio data in the file, in bytes.
+    uint64_t GetDataOffset() const
+    {
+        return m_dataOffset;
+    }
+
+    // Gets the size of the audio data, in bytes.
+    uint64_t GetDataSize() const
+    {
+        return m_dataSize;
+    }
 
-        std::ios_base::openmode mode = std::ios_base::binary | std::ios_base::in;
-        m_fs.open(audioFileName, mode);
-        if (!m_fs.good())
+    // Keeps the next bytes of the file after the read position in memory before Read() needs them,
+    // so reading a file that is not in the page cache does not wait for the disk on each page fault.
+    // The system already reads ahead a little for sequential reads; this is for slow or networked
+    // storage. 0 turns read-ahead off.
+    void SetReadAhead(uint64_t bytes)
+    {
+        m_readAhead = bytes;
+        m_prefetched = m_position - m_position % readAheadWindow;
+        if (m_readAhead > 0)
         {
-            throw std::invalid_argument("Failed to open the specified audio file.");
+            m_file.AdviseHugePages();
         }
-        
-        // Get audio format from the file header.
-        GetFormatFromWavFile();
     }
 
-    WAVEFORMAT GetFormat()
+    // Gets length bytes of the audio data that start at offset from the start of the data.
+    // It remains valid until the next call, or the next Read().
+    const uint8_t* GetData(uint64_t offset, uint64_t length) const
+    {
+        return m_file.View(m_dataOffset + offset, length);
+    }
+
+protected:
+
+    // Implements AudioSource::ReadSource() which is called to get data from the audio stream.
+    // It copies data available in the stream to 'dataBuffer', but no more than 'size' bytes.
+    // It returns the number of bytes that have been copied in 'dataBuffer'.
+    // It returns 0 to indicate that the stream reaches end or is closed.
+    // Audio that is not 16-bit PCM with all its channels is converted a whole sample frame at a time.
+    int ReadSource(uint8_t* dataBuffer, uint32_t size) override
     {
-        return m_formatHeader;
+        uint32_t length = 0;
+        if (SampleFormat::Int16 == m_format.Format && allChannels == m_channel)
+        {
+            length = (uint32_t)std::min<uint64_t>(size, m_end - m_position);
+            memcpy(dataBuffer, m_file.View(m_position, length), length);
+            m_position += length;
+        }
+        else
+        {
+            auto frames = std::min<uint64_t>(size / m_outputBlockAlign, (m_end - m_position) / m_format.BlockAlign);
+            auto source = m_file.View(m_position, frames * m_format.BlockAlign);
+            if (allChannels == m_channel)
+            {
+                ConvertToInt16(m_format.Format, source, dataBuffer, (size_t)(frames * m_format.Channels));
+            }
+            else
+            {
+                // 16-bit audio is mixed or split straight from the file. Other formats are converted
+                // to 16 bits first, a block at a time, so the buffer for them stays small.
+                for (uint64_t frame = 0; frame < frames; frame += blockFrames)
+                {
+                    auto count = (size_t)std::min(blockFrames, frames - frame);
+                    auto samples = source + frame * m_format.BlockAlign;
+                    if (SampleFormat::Int16 != m_format.Format)
+                    {
+                        ConvertToInt16(m_format.Format, samples, m_block.data(), count * m_format.Channels);
+                        samples = m_block.data();
+                    }
+                    auto target = dataBuffer + frame * sizeof(int16_t);
+                    if (mixChannels == m_channel)
+                    {
+                        MixToMono(samples, target, count, m_format.Channels);
+                    }
+                    else
+                    {
+                        ExtractChannel(samples, target, count, m_format.Channels, m_channel);
+                    }
+                }
+            }
+            m_position += frames * m_format.BlockAlign;
+            length = (uint32_t)(frames * m_outputBlockAlign);
+        }
+        while (m_readAhead > 0 && m_prefetched < m_end && m_prefetched < m_position + m_readAhead)
+        {
+            m_file.Prefetch(m_prefetched, readAheadWindow);
+            m_prefetched += readAheadWindow;
+        }
+        return (int)length;
     }
 
-    void Close()
+    // Implements AudioSource::CloseSource() which is called when the stream needs to be closed.
+    // The file stays mapped until the reader is destroyed, because the Speech SDK may still hold the stream.
+    void CloseSource() override
     {
-        m_fs.close();
+        m_position = m_end;
     }
 };
@@ -0,0 +1,135 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "wav_file_reader.h"
+
+// Part of the audio data in a WAV file.
+struct AudioSegment
+{
+    // Position of the first byte of the segment in the file.
+    uint64_t begin;
+    // Length of the segment in bytes.
+    uint64_t length;
+    // Time of the start of the segment relative to the start of the audio, in 100-nanosecond ticks.
+    uint64_t offset;
+};
+
+// Splits the audio in 16-bit PCM WAV files into segments that can be recognized independently.
+// Cuts are placed at the quietest point near each even split, so they are unlikely to fall inside a word.
+// This only reads the file; it does not use the Speech service.
+class WavSplitter final
+{
+private:
+
+    // Energy is measured in 10 ms frames.
+    static constexpr int framesPerSecond = 100;
+    // A cut is placed in the middle of the quietest 300 ms.
+    static constexpr size_t quietFrames = 30;
+    // A cut is at most 30 seconds from the even split.
+    static constexpr size_t maxSearchFrames = 30 * framesPerSecond;
+
+    // Mean square sample value of each frame.
+    // The data is read a block of frames at a time, as a 32-bit build can only map part of a large file.
+    static std::vector<float> FrameEnergies(const WavFileReader& reader, uint64_t dataSize, size_t frameBytes)
+    {
+        std::vector<float> retval;
+        retval.reserve((size_t)(dataSize / frameBytes));
+        std::vector<int16_t> frame(frameBytes / sizeof(int16_t));
+        const uint64_t blockBytes = frameBytes * (uint64_t)(1000 * framesPerSecond);
+        const uint8_t* block = nullptr;
+        uint64_t blockStart = 0;
+        for (uint64_t position = 0; position + frameBytes <= dataSize; position += frameBytes)
+        {
+            if (nullptr == block || position - blockStart >= blockBytes)
+            {
+                blockStart = position;
+                block = reader.GetData(blockStart, std::min(blockBytes, dataSize - blockStart) / frameBytes * frameBytes);
+            }
+            // The data is not necessarily aligned for int16_t.
+            memcpy(frame.data(), block + (position - blockStart), frameBytes);
+            double sum = 0;
+            for (auto sample : frame)
+            {
+                sum += (double)sample * sample;
+            }
+            retval.push_back((float)(sum / frame.size()));
+        }
+        return retval;
+    }
+
+public:
+
+    // Returns at most segmentCount segments that together cover all the audio data in the file, in order.
+    static std::vector<AudioSegment> SplitOnSilence(const std::string& fileName, int segmentCount)
+    {
+        WavFileReader reader(fileName);
+        auto format = reader.GetFormat();
+        auto dataOffset = reader.GetDataOffset();
+        auto dataSize = reader.GetDataSize();
+
+        if (SampleFormat::Int16 != format.Format || format.SamplesPerSec < framesPerSecond)
+        {
+            throw std::invalid_argument("Splitting is supported only for 16-bit PCM WAV files.");
+        }
+
+        size_t frameBytes = format.BlockAlign * (format.SamplesPerSec / framesPerSecond);
+        auto energies = FrameEnergies(reader, dataSize, frameBytes);
+
+        // Prefix sums, so the energy of any run of frames is one subtraction.
+        std::vector<double> sums(energies.size() + 1, 0);
+        for (size_t frame = 0; frame < energies.size(); frame++)
+        {
+            sums[frame + 1] = sums[frame] + energies[frame];
+        }
+
+        // Choose a cut near each even split, in frames.
+        std::vector<size_t> cuts;
+        size_t frameCount = energies.size();
+        size_t segmentFrames = segmentCount > 0 ? frameCount / segmentCount : frameCount;
+        size_t searchFrames = std::min(maxSearchFrames, segmentFrames / 2);
+        for (int segment = 1; segment < segmentCount && frameCount > quietFrames; segment++)
+        {
+            size_t target = segment * segmentFrames;
+            size_t first = std::max(target > searchFrames ? target - searchFrames : 0, cuts.empty() ? quietFrames : cuts.back() + quietFrames);
+            size_t last = std::min(target + searchFrames, frameCount - quietFrames);
+            if (first > last)
+            {
+                continue;
+            }
+
+            size_t best = first;
+            double bestEnergy = sums[first + quietFrames] - sums[first];
+            for (size_t start = first + 1; start <= last; start++)
+            {
+                double energy = sums[start + quietFrames] - sums[start];
+                if (energy < bestEnergy)
+                {
+                    best = start;
+                    bestEnergy = energy;
+                }
+            }
+            cuts.push_back(best + quietFrames / 2);
+        }
+
+        auto ticksAt = [&format](uint64_t position) { return position / format.BlockAlign * 10000000 / format.SamplesPerSec; };
+        std::vector<AudioSegment> retval;
+        uint64_t begin = 0;
+        for (auto cut : cuts)
+        {
+            uint64_t end = cut * frameBytes;
+            retval.push_back({ dataOffset + begin, end - begin, ticksAt(begin) });
+            begin = end;
+        }
+        retval.push_back({ dataOffset + begin, dataSize - begin, ticksAt(begin) });
+        return retval;
+    }
+};
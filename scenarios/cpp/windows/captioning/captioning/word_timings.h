@@ -0,0 +1,143 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "break_table.h"
+
+// Word timings from a detailed recognition result, indexed by where each word starts in the
+// result text, so the timing of a caption can be found with a binary search over the words
+// instead of assuming that time is spread evenly across characters.
+class WordTimings
+{
+private:
+
+    struct Word
+    {
+        // Grapheme cluster index in the result text where the word starts.
+        size_t position;
+        uint64_t offset;
+        uint64_t duration;
+    };
+
+    std::vector<Word> m_words;
+    std::vector<size_t> m_tokenPositions;
+    std::vector<size_t> m_lexicalPositions;
+
+    // Whether word is an object whose Word is a string and whose Offset and Duration are unsigned integers,
+    // where present. value() throws nlohmann::json::type_error for a field of another type.
+    static bool IsWord(const nlohmann::json& word)
+    {
+        if (!word.is_object())
+        {
+            return false;
+        }
+        auto text = word.find("Word");
+        auto offset = word.find("Offset");
+        auto duration = word.find("Duration");
+        return (word.end() == text || text->is_string())
+            && (word.end() == offset || offset->is_number_unsigned())
+            && (word.end() == duration || duration->is_number_unsigned());
+    }
+
+    // Counts code points, which is close enough to grapheme clusters for mapping lexical words to display text.
+    static size_t CodePointCount(const std::string& text)
+    {
+        return std::count_if(text.begin(), text.end(), [](char c) { return ((unsigned char)c & 0xC0) != 0x80; });
+    }
+
+public:
+
+    // Builds the index from the JSON of a result recognized with OutputFormat::Detailed and word level timestamps.
+    // breakTable must have been built from the display text of the same result.
+    // Returns false, and leaves the index empty, if the JSON has no word timings, or they are not of the
+    // expected types.
+    bool Build(const std::string& json, const BreakTable& breakTable)
+    {
+        m_words.clear();
+
+        // Check each type before indexing, because operator[] and value() throw for the wrong type.
+        const auto parsed = nlohmann::json::parse(json, nullptr, false);
+        if (parsed.is_discarded() || !parsed.is_object())
+        {
+            return false;
+        }
+        auto nbest = parsed.find("NBest");
+        if (parsed.end() == nbest || !nbest->is_array() || nbest->empty() || !(*nbest)[0].is_object())
+        {
+            return false;
+        }
+        // The first item in the NBest array corresponds to the recognized text.
+        auto found = (*nbest)[0].find("Words");
+        if ((*nbest)[0].end() == found || !found->is_array() || found->empty()
+            || !std::all_of(found->begin(), found->end(), IsWord))
+        {
+            return false;
+        }
+        const auto& words = *found;
+
+        // Words are lexical, while the caption is display text, which can differ in punctuation,
+        // capitalization and number formatting. When the display text has one space-separated token
+        // per word, map word to token directly. Otherwise, map positions proportionally.
+        m_tokenPositions.clear();
+        for (size_t cluster = 0; cluster < breakTable.Size(); cluster++)
+        {
+            if (!breakTable.IsSpaceAt(cluster) && (0 == cluster || breakTable.IsSpaceAt(cluster - 1)))
+            {
+                m_tokenPositions.push_back(cluster);
+            }
+        }
+
+        m_lexicalPositions.clear();
+        size_t lexicalLength = 0;
+        for (const auto& word : words)
+        {
+            m_lexicalPositions.push_back(lexicalLength);
+            lexicalLength += CodePointCount(word.value("Word", "")) + 1;
+        }
+
+        auto useTokens = m_tokenPositions.size() == words.size();
+        for (size_t index = 0; index < words.size(); index++)
+        {
+            auto position = useTokens
+                ? m_tokenPositions[index]
+                : m_lexicalPositions[index] * breakTable.Size() / lexicalLength;
+            m_words.push_back({ position, words[index].value("Offset", (uint64_t)0), words[index].value("Duration", (uint64_t)0) });
+        }
+
+        return true;
+    }
+
+    bool Empty() const
+    {
+        return m_words.empty();
+    }
+
+    void Clear()
+    {
+        m_words.clear();
+    }
+
+    // Gets the begin and end ticks of the words that start in [begin, end), a range of grapheme clusters in the result text.
+    // Returns false if no word starts in that range.
+    bool TimingForRange(size_t begin, size_t end, uint64_t& beginTicks, uint64_t& endTicks) const
+    {
+        auto byPosition = [](const Word& word, size_t position) { return word.position < position; };
+        auto first = std::lower_bound(m_words.begin(), m_words.end(), begin, byPosition);
+        auto last = std::lower_bound(first, m_words.end(), end, byPosition);
+        if (first == last)
+        {
+            return false;
+        }
+
+        beginTicks = first->offset;
+        endTicks = (last - 1)->offset + (last - 1)->duration;
+        return true;
+    }
+};
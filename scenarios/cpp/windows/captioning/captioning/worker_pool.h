@@ -0,0 +1,208 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run posted tasks.
+class WorkerPool final
+{
+private:
+
+    std::mutex m_mutex;
+    std::condition_variable m_available;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+
+    void Work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_available.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+
+    WorkerPool(size_t threads)
+    {
+        if (0 == threads)
+        {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; i++)
+        {
+            m_threads.emplace_back([this] { Work(); });
+        }
+    }
+
+    // Runs the tasks that are already posted, then stops the threads.
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_available.notify_all();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void Post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_available.notify_one();
+    }
+};
+
+// Runs posted tasks one at a time, in the order they were posted, on a shared WorkerPool.
+// Each SerialQueue has its own lock, so sessions that use different queues do not contend,
+// and the pool holds at most one entry per queue, so its length is bounded by the number of queues.
+// The queue itself holds at most capacity tasks; Post() waits for room, which slows down
+// only the producer that is ahead of its queue.
+class SerialQueue final
+{
+private:
+
+    // How many tasks to run before yielding the pool thread to other queues.
+    static constexpr int batchSize = 16;
+
+    WorkerPool& m_pool;
+    const size_t m_capacity;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_scheduled = false;
+
+    void Run()
+    {
+        for (int count = 0; count < batchSize; count++)
+        {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_tasks.empty())
+                {
+                    m_scheduled = false;
+                    m_changed.notify_all();
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            m_changed.notify_all();
+            task();
+        }
+        // Let other queues run, then continue.
+        m_pool.Post([this] { Run(); });
+    }
+
+public:
+
+    SerialQueue(WorkerPool& pool, size_t capacity) : m_pool(pool), m_capacity(capacity)
+    {}
+
+    // Waits for queued tasks to finish.
+    ~SerialQueue()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this] { return !m_scheduled; });
+    }
+
+    SerialQueue(const SerialQueue&) = delete;
+    SerialQueue& operator=(const SerialQueue&) = delete;
+
+    void Post(std::function<void()> task)
+    {
+        bool schedule = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_tasks.size() < m_capacity; });
+            m_tasks.push_back(std::move(task));
+            schedule = !m_scheduled;
+            m_scheduled = true;
+        }
+        if (schedule)
+        {
+            m_pool.Post([this] { Run(); });
+        }
+    }
+};
+
+// Runs a task on its own thread every period, until it is destroyed. The task should be short, such as
+// posting work to a SerialQueue, so the period stays regular.
+class PeriodicTask final
+{
+private:
+
+    const std::chrono::milliseconds m_period;
+    const std::function<void()> m_task;
+    std::mutex m_mutex;
+    std::condition_variable m_stopped;
+    bool m_stopping = false;
+    std::thread m_thread;
+
+    void Run()
+    {
+        auto next = std::chrono::steady_clock::now() + m_period;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopped.wait_until(lock, next, [this] { return m_stopping; }))
+        {
+            lock.unlock();
+            m_task();
+            lock.lock();
+            // A task that overran its period is not made up with a burst of runs.
+            next = std::max(next + m_period, std::chrono::steady_clock::now());
+        }
+    }
+
+public:
+
+    PeriodicTask(std::chrono::milliseconds period, std::function<void()> task) : m_period(period), m_task(std::move(task))
+    {
+        m_thread = std::thread([this] { Run(); });
+    }
+
+    // Waits for a task that is running to finish.
+    ~PeriodicTask()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_stopped.notify_all();
+        m_thread.join();
+    }
+
+    PeriodicTask(const PeriodicTask&) = delete;
+    PeriodicTask& operator=(const PeriodicTask&) = delete;
+};